@@ -0,0 +1,198 @@
+/*
+ * Copyright 2020 Wenxin Wang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "AudioPlayout.h"
+#include "RtCheck.h"
+#include "Tracing.h"
+#include <arpa/inet.h>
+#include <algorithm>
+
+namespace {
+    // Within tolerance, do nothing; beyond max slew, jump instead of skipping/repeating
+    // one frame per callback.
+    const int64_t kSyncToleranceUs = 250;
+    const int64_t kSyncMaxSlewUs = 20000;
+}
+
+AudioPlayout::AudioPlayout(PacketBuffer &pkt_buffer, RtLog &rt_log, unsigned num_channel,
+                           unsigned mask_channel, const RtcpSession *rtcp,
+                           int64_t sync_delay_ns)
+        : pkt_buffer_(pkt_buffer), rt_log_(rt_log), rtcp_(rtcp), sync_delay_ns_(sync_delay_ns),
+          num_channel_(num_channel), mask_channel_(mask_channel & ((1U << num_channel) - 1)),
+          last_samples_(num_channel), sync_error_(0) {
+    if (!mask_channel_) {
+        mask_channel_ = (1U << num_channel) - 1;
+    }
+    mask_channel = mask_channel_;
+    while (mask_channel) {
+        if (mask_channel & 1U) {
+            ++num_output_channel_;
+        }
+        mask_channel >>= 1U;
+    }
+}
+
+bool AudioPlayout::GetSyncError(unsigned sample_rate, int64_t present_ns, int32_t *error) {
+    RtpClockMapping mapping{};
+    if (!rtcp_ || present_ns < 0 || !rtcp_->GetMapping(&mapping) || !EnsureBuffer()) {
+        return false;
+    }
+    // The stream runs at the sender's rate, so RTP timestamps are in frames as well
+    int64_t target_frames =
+            (present_ns - sync_delay_ns_ - mapping.wall_ns) * sample_rate / 1000000000LL;
+    uint32_t target_ts = mapping.rtp_ts + uint32_t(target_frames);
+    uint32_t current_ts = pkt_buffer_.head_timestamp() + offset_ / num_channel_;
+    *error = int32_t(current_ts - target_ts);
+    return true;
+}
+
+void AudioPlayout::SkipFrames(int32_t num_frames) {
+    while (num_frames > 0 && EnsureBuffer()) {
+        auto step = std::min<int32_t>(num_frames, (buffer_->size() - offset_) / num_channel_);
+        if (!step) {
+            // Drop the incomplete frame at the end of the packet
+            offset_ = buffer_->size();
+            continue;
+        }
+        offset_ += step * num_channel_;
+        num_frames -= step;
+    }
+}
+
+bool AudioPlayout::EnsureBuffer() {
+    while (!buffer_ || offset_ >= buffer_->size()) {
+        offset_ = 0;
+        buffer_ = pkt_buffer_.RefNextHeadForRead();
+        if (!buffer_) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int32_t AudioPlayout::Render(int16_t *output, int32_t num_frames, unsigned sample_rate,
+                             int64_t present_ns) {
+    RT_SECTION();
+    TRACE_SCOPE("AudioPlayout::Render");
+    int32_t sync_error = 0;
+    int32_t num_silence = 0;
+    bool is_synced = GetSyncError(sample_rate, present_ns, &sync_error);
+    if (is_synced) {
+        sync_error_.store(sync_error);
+        TRACE_COUNTER("AudioPlayout::syncError", sync_error);
+        auto tolerance = int32_t(sample_rate * kSyncToleranceUs / 1000000);
+        auto max_slew = int32_t(sample_rate * kSyncMaxSlewUs / 1000000);
+        if (sync_error < -max_slew) {
+            // Too late, jump forward
+            SkipFrames(-sync_error);
+            sync_error = 0;
+        } else if (sync_error > max_slew) {
+            // Too early, wait with silence
+            num_silence = std::min(sync_error, num_frames);
+            sync_error = 0;
+        }
+        if (sync_error < -tolerance) {
+            state_ = State::Overrun;
+        } else if (sync_error > tolerance) {
+            state_ = State::Underrun;
+        } else {
+            state_ = State::None;
+        }
+    }
+
+    auto old_state = state_;
+    if (state_ == State::None && !is_synced) {
+        auto num_pkt = pkt_buffer_.size();
+        if (num_pkt < pkt_buffer_.capacity() / 32) {
+            state_ = State::Depleted;
+        } else if (num_pkt < pkt_buffer_.capacity() / 16) {
+            state_ = State::Underrun;
+        } else if (num_pkt > pkt_buffer_.capacity() / 2) {
+            state_ = State::Overrun;
+        }
+        if (state_ != old_state) {
+            TRACE_COUNTER("AudioPlayout::state", state_);
+            RT_LOGE(rt_log_, "Enter state %u -> %u %u", unsigned(old_state), unsigned(state_),
+                    num_output_channel_);
+        }
+    }
+    old_state = state_;
+    bool has_adjustment_ = false;
+    int32_t num_missing = 0;
+    for (int i = 0; i < num_frames; ++i) {
+        if (i < num_silence) {
+            std::fill_n(output + i * num_output_channel_, num_output_channel_, 0);
+            continue;
+        }
+        unsigned mask_channel = mask_channel_;
+        unsigned k = 0;
+        bool is_missing = false;
+        for (unsigned j = 0; j < num_channel_; ++j) {
+            if (state_ == State::Depleted || !EnsureBuffer()) {
+                state_ = State::Depleted;
+                is_missing = true;
+                // LOGE("No more data: %zu/%d", num_sample, numFrames);
+            } else {
+                last_samples_[j] = ntohs((*buffer_)[offset_]);
+                ++offset_;
+            }
+            if (mask_channel & 1U) {
+                // only fill channel selected by mask
+                output[i * num_output_channel_ + k] = last_samples_[j];
+                ++k;
+            }
+            mask_channel >>= 1U;
+        }
+        if (is_missing) {
+            ++num_missing;
+        }
+        if (state_ != State::None) {
+            // When synced, the state comes from the sync error instead of the buffer fill
+            if (!is_synced) {
+                auto num_pkt = pkt_buffer_.size();
+                if (num_pkt < pkt_buffer_.capacity() / 32) {
+                    state_ = State::Depleted;
+                } else if (num_pkt < pkt_buffer_.capacity() / 8) {
+                    if (state_ != State::Depleted) {
+                        state_ = State::Underrun;
+                    }
+                } else if (num_pkt > pkt_buffer_.capacity() / 4) {
+                    state_ = State::Overrun;
+                } else {
+                    state_ = State::None;
+                }
+            }
+            if (!has_adjustment_) {
+                has_adjustment_ = true;
+                if (state_ == State::Overrun) {
+                    // skip one sample
+                    // LOGE("OVERRUN %u/%u", num_pkt, pkt_buffer_capacity());
+                    offset_ += num_channel_;
+                } else if (state_ == State::Underrun && offset_ >= num_channel_) {
+                    // repeat one sample
+                    // LOGE("UNDERRUN %u/%u", num_pkt, pkt_buffer_capacity());
+                    offset_ -= num_channel_;
+                }
+            }
+        }
+        if (state_ != old_state && !is_synced) {
+            TRACE_COUNTER("AudioPlayout::state", state_);
+            RT_LOGE(rt_log_, "Change state1 %u -> %u", unsigned(old_state), unsigned(state_));
+            old_state = state_;
+        }
+    }
+    return num_missing;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2020 Wenxin Wang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PULSERTP_AUDIOPLAYOUT_H
+#define PULSERTP_AUDIOPLAYOUT_H
+
+#include <cstdint>
+#include <atomic>
+#include <vector>
+#include "RtcpSession.h"
+#include "RtLog.h"
+#include "RtpReceiver.h"
+
+// The audio callback without the audio output: pulls frames out of the packet buffer, and
+// skips or repeats a frame per callback to keep the buffer fill, or with RTCP the play
+// time, in range. Everything but the accessors runs on the audio thread.
+class AudioPlayout {
+public:
+    // rtcp: if not null, play RTP timestamps sync_delay_ns after the sender's wall clock
+    AudioPlayout(PacketBuffer &pkt_buffer, RtLog &rt_log, unsigned num_channel,
+                 unsigned mask_channel, const RtcpSession *rtcp, int64_t sync_delay_ns);
+
+    // Fills num_frames of the masked channels into output. present_ns is the wall clock
+    // (ns since unix epoch) at which the first frame will be heard, -1 if unknown.
+    // Returns the number of frames that had no data and repeated the last sample.
+    int32_t Render(int16_t *output, int32_t num_frames, unsigned sample_rate,
+                   int64_t present_ns);
+
+    unsigned num_output_channel() const { return num_output_channel_; }
+
+    // Frames between what is played and what RTCP says should be played, positive if ahead
+    int sync_error() const { return sync_error_; }
+
+private:
+    bool GetSyncError(unsigned sample_rate, int64_t present_ns, int32_t *error);
+
+    void SkipFrames(int32_t num_frames);
+
+    bool EnsureBuffer();
+
+    PacketBuffer &pkt_buffer_;
+    RtLog &rt_log_;
+    const RtcpSession *rtcp_;
+    const int64_t sync_delay_ns_;
+    const unsigned num_channel_;
+    unsigned num_output_channel_ = 0;
+    unsigned mask_channel_ = 0;
+
+    const std::vector<int16_t> *buffer_ = nullptr;
+    unsigned offset_ = 0;
+    std::vector<int16_t> last_samples_;
+    enum State {
+        None,
+        Overrun,
+        Underrun,
+        Depleted,
+    } state_ = State::None;
+
+    std::atomic<int> sync_error_;
+};
+
+#endif //PULSERTP_AUDIOPLAYOUT_H
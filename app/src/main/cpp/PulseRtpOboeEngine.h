@@ -20,89 +20,20 @@
 #include <cstdint>
 #include <vector>
 #include <atomic>
-#include <thread>
-#include <asio.hpp>
 #include <oboe/Oboe.h>
-
-#define MODULE_NAME "PULSE_RTP_OBOE_ENGINE"
-
-// MTU: 1280, channel 2, sample se16e -> 320 sample per pkt
-// 48k sample per s -> 150 pkt/s
-// 100ms buffer: 15pkt
-// RTP payload: 1280 + 12 = 1292
-
-class PacketBuffer {
-public:
-    PacketBuffer(unsigned mtu, unsigned sample_rate, unsigned max_latency, unsigned num_channel);
-
-    const std::vector<int16_t> *RefNextHeadForRead();
-
-    std::vector<int16_t> *RefTailForWrite();
-
-    bool NextTail();
-
-    unsigned capacity() const { return pkts_.size(); }
-
-    unsigned size() const { return size_; }
-
-    unsigned head_move_req() const { return head_move_req_; }
-
-    unsigned head_move() const { return head_move_; }
-
-    unsigned tail_move_req() const { return tail_move_req_; }
-
-    unsigned tail_move() const { return tail_move_; }
-
-private:
-    std::vector<std::vector<int16_t>> pkts_;
-    std::atomic<unsigned> head_;
-    std::atomic<unsigned> tail_;
-    std::atomic<unsigned> size_;
-
-    std::atomic<unsigned> head_move_req_;
-    std::atomic<unsigned> head_move_;
-    std::atomic<unsigned> tail_move_req_;
-    std::atomic<unsigned> tail_move_;
-};
-
-class RtpReceiveThread {
-public:
-    RtpReceiveThread(PacketBuffer &pkt_buffer, std::string ip, uint16_t port, unsigned mtu);
-
-    ~RtpReceiveThread();
-
-    bool Start();
-
-    unsigned pkt_recved() const { return pkt_recved_; }
-
-private:
-    void Restart();
-
-    void Stop();
-
-    void StartReceive();
-
-    void HandleReceive(size_t bytes_recvd);
-
-    PacketBuffer &pkt_buffer_;
-    asio::io_context io_;
-    std::string ip_;
-    uint16_t port_;
-    asio::ip::udp::socket socket_;
-    asio::ip::udp::endpoint sender_endpoint_;
-    std::vector<char> data_;
-    asio::steady_timer idle_check_timer_;
-    std::thread thread_;
-    bool is_idle_ = false;
-    unsigned pkt_recved_ = 0;
-};
+#include "AudioPlayout.h"
+#include "RtcpSession.h"
+#include "RtLog.h"
+#include "RtpReceiver.h"
+#include "SeqLock.h"
 
 class PulseRtpOboeEngine
         : public oboe::AudioStreamCallback {
 public:
     static std::unique_ptr<PulseRtpOboeEngine> Create(
             int latency_option, const std::string &ip, uint16_t port, unsigned mtu,
-            unsigned max_latency, unsigned num_channel, unsigned mask_channel
+            unsigned max_latency, unsigned num_channel, unsigned mask_channel,
+            unsigned suspend_idle, unsigned sync_delay, unsigned sample_rate
     );
 
     ~PulseRtpOboeEngine();
@@ -125,6 +56,11 @@ public:
 
     unsigned pkt_recved() const { return receive_thread_.pkt_recved(); }
 
+    bool is_suspended() const { return receive_thread_.is_suspended(); }
+
+    // Frames between what is played and what RTCP says should be played, positive if ahead
+    int sync_error() const { return playout_.sync_error(); }
+
     int32_t getBufferCapacityInFrames() const {
         return managedStream_->getBufferSizeInFrames();
     }
@@ -146,34 +82,42 @@ public:
 
 private:
     PulseRtpOboeEngine(const std::string &ip, uint16_t port, unsigned mtu,
-                       unsigned max_latency, unsigned num_channel, unsigned mask_channel);
+                       unsigned max_latency, unsigned num_channel, unsigned mask_channel,
+                       unsigned suspend_idle, unsigned sync_delay, unsigned sample_rate);
 
     bool Start(int latency_option, const std::string &ip, uint16_t port, unsigned mtu);
 
     void Stop();
 
-    bool EnsureBuffer();
+    void Suspend();
+
+    void Resume();
 
+    void UpdatePresentationClock();
+
+    RtLog rt_log_;
     PacketBuffer pkt_buffer_;
+    RtcpSession rtcp_session_;
     RtpReceiveThread receive_thread_;
+    AudioPlayout playout_;
     oboe::ManagedStream managedStream_;
     std::unique_ptr<oboe::LatencyTuner> latencyTuner_;
 
-    unsigned num_channel_ = 0;
-    unsigned num_output_channel_ = 0;
-    unsigned mask_channel_ = 0;
-
-    const std::vector<int16_t> *buffer_ = nullptr;
-    unsigned offset_ = 0;
-    std::vector<int16_t> last_samples_;
-    enum State {
-        None,
-        Overrun,
-        Underrun,
-        Depleted,
-    } state_ = State::None;
+    // 0 to use the device default
+    unsigned sample_rate_ = 0;
+    unsigned max_latency_ = 0;
+    unsigned suspend_idle_ = 0;
+    int64_t sync_delay_ns_ = 0;
     bool is_thread_affinity_set_ = false;
 
+    // Presentation time of a frame position, sampled outside the audio callback
+    struct PresentationClock {
+        int64_t frame_position;
+        int64_t monotonic_ns;
+        int64_t realtime_offset_ns;
+    };
+    SeqLock<PresentationClock> presentation_clock_;
+
     std::atomic<int> num_underrun_;
     std::atomic<int> audio_buffer_size_;
 };
@@ -0,0 +1,174 @@
+/*
+ * Copyright 2020 Wenxin Wang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "RtCheck.h"
+
+#ifdef PULSERTP_RT_CHECK
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <unistd.h>
+
+#ifndef __ANDROID__
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#endif
+
+namespace {
+    std::atomic<bool> is_armed(false);
+    std::atomic<bool> is_abort_on_violation(false);
+    std::atomic<unsigned> num_violations(0);
+    std::atomic<const char *> first(nullptr);
+    thread_local int section_depth = 0;
+    // Hooks may be re-entered while reporting, e.g. write() in abort
+    thread_local bool is_in_check = false;
+
+    void WriteStderr(const char *s) {
+        auto ret = ::write(STDERR_FILENO, s, strlen(s));
+        (void) ret;
+    }
+}
+
+void rt_check::Arm(bool abort_on_violation) {
+    is_abort_on_violation = abort_on_violation;
+    is_armed = true;
+}
+
+void rt_check::Disarm() {
+    is_armed = false;
+}
+
+unsigned rt_check::violations() {
+    return num_violations;
+}
+
+const char *rt_check::first_violation() {
+    return first;
+}
+
+void rt_check::Check(const char *what) {
+    if (!section_depth || is_in_check || !is_armed.load(std::memory_order_relaxed)) {
+        return;
+    }
+    is_in_check = true;
+    ++num_violations;
+    const char *expected = nullptr;
+    first.compare_exchange_strong(expected, what);
+    if (is_abort_on_violation) {
+        WriteStderr("rt_check: ");
+        WriteStderr(what);
+        WriteStderr(" in real-time section\n");
+        abort();
+    }
+    is_in_check = false;
+}
+
+rt_check::Section::Section() {
+    ++section_depth;
+}
+
+rt_check::Section::~Section() {
+    --section_depth;
+}
+
+#ifdef __ANDROID__
+
+// Only allocations made by this library can be seen on Android
+void *operator new(size_t size) {
+    rt_check::Check("operator new");
+    void *p = malloc(size);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete[](void *p) noexcept {
+    free(p);
+}
+
+#else
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t num, size_t size);
+void *__libc_realloc(void *p, size_t size);
+
+void *malloc(size_t size) {
+    rt_check::Check("malloc");
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t num, size_t size) {
+    rt_check::Check("calloc");
+    return __libc_calloc(num, size);
+}
+
+void *realloc(void *p, size_t size) {
+    rt_check::Check("realloc");
+    return __libc_realloc(p, size);
+}
+}
+
+namespace {
+    template<typename F>
+    F Next(const char *name) {
+        return reinterpret_cast<F>(dlsym(RTLD_NEXT, name));
+    }
+}
+
+extern "C" {
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+    static auto next = Next<int (*)(pthread_mutex_t *)>("pthread_mutex_lock");
+    rt_check::Check("pthread_mutex_lock");
+    return next(mutex);
+}
+
+ssize_t write(int fd, const void *buf, size_t count) {
+    static auto next = Next<ssize_t (*)(int, const void *, size_t)>("write");
+    rt_check::Check("write");
+    return next(fd, buf, count);
+}
+
+ssize_t sendto(int fd, const void *buf, size_t len, int flags,
+               const struct sockaddr *dest_addr, socklen_t addrlen) {
+    static auto next = Next<ssize_t (*)(int, const void *, size_t, int,
+                                        const struct sockaddr *, socklen_t)>("sendto");
+    rt_check::Check("sendto");
+    return next(fd, buf, len, flags, dest_addr, addrlen);
+}
+
+ssize_t sendmsg(int fd, const struct msghdr *msg, int flags) {
+    static auto next = Next<ssize_t (*)(int, const struct msghdr *, int)>("sendmsg");
+    rt_check::Check("sendmsg");
+    return next(fd, msg, flags);
+}
+}
+
+#endif // __ANDROID__
+
+#endif // PULSERTP_RT_CHECK
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2020 Wenxin Wang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PULSERTP_RTCHECK_H
+#define PULSERTP_RTCHECK_H
+
+// Checks that real-time sections (the audio callback and per-packet handling) don't
+// allocate, lock or make blocking syscalls. Only compiled in with PULSERTP_RT_CHECK.
+//
+// Nothing is checked until Arm() is called, which should happen once the engine has warmed
+// up. Allocations are caught through operator new; on non-Android hosts, malloc, mutex
+// locks and blocking socket/file writes are interposed as well.
+#ifdef PULSERTP_RT_CHECK
+
+namespace rt_check {
+    // abort_on_violation: abort with a message on stderr, to fail a test right away
+    void Arm(bool abort_on_violation);
+
+    void Disarm();
+
+    unsigned violations();
+
+    // What the first violation was, e.g. "malloc", nullptr if none
+    const char *first_violation();
+
+    // For hooks: reports a violation if the calling thread is in an armed section
+    void Check(const char *what);
+
+    class Section {
+    public:
+        Section();
+
+        ~Section();
+
+        Section(const Section &) = delete;
+
+        Section &operator=(const Section &) = delete;
+    };
+}
+
+#define RT_CHECK_CONCAT_(a, b) a##b
+#define RT_CHECK_CONCAT(a, b) RT_CHECK_CONCAT_(a, b)
+#define RT_SECTION() rt_check::Section RT_CHECK_CONCAT(rt_section_, __LINE__)
+
+#else
+
+#define RT_SECTION() do {} while (0)
+
+#endif // PULSERTP_RT_CHECK
+
+#endif //PULSERTP_RTCHECK_H
@@ -0,0 +1,122 @@
+/*
+ * Copyright 2020 Wenxin Wang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "RtLog.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+
+namespace {
+    // Drain every 100ms while there are messages, backing off to every 2s when there are none
+    const unsigned kDrainIntervalMs = 100;
+    const unsigned kMaxDrainIntervalMs = 2000;
+
+    size_t RoundUpPowerOfTwo(size_t n) {
+        size_t size = 1;
+        while (size < n) {
+            size <<= 1U;
+        }
+        return size;
+    }
+}
+
+RtLog::RtLog(const char *tag, unsigned capacity)
+        : tag_(tag), records_(RoundUpPowerOfTwo(capacity)), mask_(records_.size() - 1),
+          enqueue_pos_(0), dropped_(0) {
+    for (size_t i = 0; i < records_.size(); ++i) {
+        records_[i].seq.store(i, std::memory_order_relaxed);
+    }
+}
+
+RtLog::~RtLog() {
+    Stop();
+}
+
+void RtLog::Start() {
+    std::lock_guard<std::mutex> lk(mutex_);
+    if (!is_stopped_) {
+        return;
+    }
+    is_stopped_ = false;
+    thread_ = std::thread([this]() {
+        std::unique_lock<std::mutex> lk(mutex_);
+        unsigned interval_ms = kDrainIntervalMs;
+        while (!is_stopped_) {
+            cv_.wait_for(lk, std::chrono::milliseconds(interval_ms));
+            if (Drain()) {
+                interval_ms = kDrainIntervalMs;
+            } else {
+                interval_ms = std::min(interval_ms * 2, kMaxDrainIntervalMs);
+            }
+        }
+    });
+}
+
+void RtLog::Stop() {
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        is_stopped_ = true;
+        cv_.notify_all();
+    }
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    Drain();
+}
+
+void RtLog::Push(int priority, const char *fmt, ...) {
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    Record *record;
+    while (true) {
+        record = &records_[pos & mask_];
+        size_t seq = record->seq.load(std::memory_order_acquire);
+        auto diff = intptr_t(seq) - intptr_t(pos);
+        if (diff == 0) {
+            if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Full, the drain thread is behind
+            ++dropped_;
+            return;
+        } else {
+            pos = enqueue_pos_.load(std::memory_order_relaxed);
+        }
+    }
+    record->priority = priority;
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(record->message, kMaxMessage, fmt, args);
+    va_end(args);
+    record->seq.store(pos + 1, std::memory_order_release);
+}
+
+size_t RtLog::Drain() {
+    size_t num_drained = 0;
+    while (true) {
+        Record *record = &records_[dequeue_pos_ & mask_];
+        size_t seq = record->seq.load(std::memory_order_acquire);
+        if (seq != dequeue_pos_ + 1) {
+            break;
+        }
+        __android_log_print(record->priority, tag_, "%s", record->message);
+        record->seq.store(dequeue_pos_ + records_.size(), std::memory_order_release);
+        ++dequeue_pos_;
+        ++num_drained;
+    }
+    return num_drained;
+}
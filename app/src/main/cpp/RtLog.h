@@ -0,0 +1,75 @@
+/*
+ * Copyright 2020 Wenxin Wang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PULSERTP_RTLOG_H
+#define PULSERTP_RTLOG_H
+
+#include <android/log.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Logging for real-time threads. Push formats into a preallocated record and never blocks,
+// a background thread drains the records to logcat. Records are dropped if the ring is full.
+class RtLog {
+public:
+    explicit RtLog(const char *tag, unsigned capacity = 256);
+
+    ~RtLog();
+
+    void Start();
+
+    void Stop();
+
+    void Push(int priority, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+    unsigned dropped() const { return dropped_; }
+
+private:
+    static const size_t kMaxMessage = 120;
+
+    struct Record {
+        std::atomic<size_t> seq;
+        int priority;
+        char message[kMaxMessage];
+    };
+
+    // Returns the number of records written out
+    size_t Drain();
+
+    const char *tag_;
+
+    // Bounded MPMC queue from Dmitry Vyukov, only the drain thread dequeues
+    std::vector<Record> records_;
+    const size_t mask_;
+    std::atomic<size_t> enqueue_pos_;
+    size_t dequeue_pos_ = 0;
+    std::atomic<unsigned> dropped_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool is_stopped_ = true;
+    std::thread thread_;
+};
+
+#define RT_LOGI(log, ...) (log).Push(ANDROID_LOG_INFO, __VA_ARGS__)
+#define RT_LOGW(log, ...) (log).Push(ANDROID_LOG_WARN, __VA_ARGS__)
+#define RT_LOGE(log, ...) (log).Push(ANDROID_LOG_ERROR, __VA_ARGS__)
+
+#endif //PULSERTP_RTLOG_H
@@ -0,0 +1,172 @@
+/*
+ * Copyright 2020 Wenxin Wang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "RtcpSession.h"
+#include <cmath>
+#include <random>
+
+namespace {
+    const uint8_t kRtcpSenderReport = 200;
+    const uint8_t kRtcpReceiverReport = 201;
+    const size_t kSenderReportSize = 28;
+    const size_t kReceiverReportSize = 32;
+    // Seconds from 1900-01-01 (NTP epoch) to 1970-01-01 (unix epoch)
+    const int64_t kNtpUnixOffset = 2208988800LL;
+    const uint16_t kMaxDropout = 3000;
+    const uint16_t kMaxMisorder = 100;
+
+    uint16_t ReadBe16(const uint8_t *p) {
+        return uint16_t((unsigned(p[0]) << 8U) | p[1]);
+    }
+
+    uint32_t ReadBe32(const uint8_t *p) {
+        return (uint32_t(p[0]) << 24U) | (uint32_t(p[1]) << 16U) |
+               (uint32_t(p[2]) << 8U) | p[3];
+    }
+
+    void WriteBe16(uint8_t *p, uint16_t v) {
+        p[0] = uint8_t(v >> 8U);
+        p[1] = uint8_t(v);
+    }
+
+    void WriteBe32(uint8_t *p, uint32_t v) {
+        p[0] = uint8_t(v >> 24U);
+        p[1] = uint8_t(v >> 16U);
+        p[2] = uint8_t(v >> 8U);
+        p[3] = uint8_t(v);
+    }
+}
+
+RtcpSession::RtcpSession(unsigned clock_rate)
+        : clock_rate_(clock_rate), ssrc_(std::random_device()()) {
+}
+
+void RtcpSession::OnRtp(const uint8_t *header, int64_t now_ns) {
+    uint16_t seq = ReadBe16(header + 2);
+    uint32_t rtp_ts = ReadBe32(header + 4);
+    uint32_t ssrc = ReadBe32(header + 8);
+    if (!has_rtp_ || ssrc != sender_ssrc_) {
+        // New (or restarted) sender, start over
+        has_rtp_ = true;
+        sender_ssrc_ = ssrc;
+        max_seq_ = seq;
+        cycles_ = 0;
+        base_seq_ = seq;
+        received_ = 0;
+        expected_prior_ = 0;
+        received_prior_ = 0;
+        jitter_ = 0;
+        transit_ = 0;
+    } else {
+        // RFC 3550 A.1, without probation
+        uint16_t udelta = seq - max_seq_;
+        if (udelta < kMaxDropout) {
+            if (seq < max_seq_) {
+                cycles_ += 1U << 16U;
+            }
+            max_seq_ = seq;
+        } else if (udelta <= (1U << 16U) - kMaxMisorder) {
+            // Sender jumped, treat as restarted
+            max_seq_ = seq;
+            cycles_ = 0;
+            base_seq_ = seq;
+            received_ = 0;
+            expected_prior_ = 0;
+            received_prior_ = 0;
+        }
+    }
+    ++received_;
+
+    // RFC 3550 A.8
+    double arrival = double(now_ns) * 1e-9 * clock_rate_;
+    double transit = arrival - rtp_ts;
+    if (received_ > 1) {
+        double d = std::fabs(transit - transit_);
+        jitter_ += (d - jitter_) / 16;
+    }
+    transit_ = transit;
+}
+
+bool RtcpSession::OnRtcp(const uint8_t *data, size_t size, int64_t now_ns) {
+    bool has_sr = false;
+    // Walk through the compound packet
+    while (size >= 4) {
+        if ((data[0] >> 6U) != 2) {
+            break;
+        }
+        size_t len = (size_t(ReadBe16(data + 2)) + 1) * 4;
+        if (len > size) {
+            break;
+        }
+        // Only the sender being played: another one's clock has nothing to do with our packets
+        if (data[1] == kRtcpSenderReport && len >= kSenderReportSize && has_rtp_ &&
+            ReadBe32(data + 4) == sender_ssrc_) {
+            uint32_t ntp_sec = ReadBe32(data + 8);
+            uint32_t ntp_frac = ReadBe32(data + 12);
+            RtpClockMapping mapping{};
+            mapping.wall_ns = (int64_t(ntp_sec) - kNtpUnixOffset) * 1000000000LL +
+                              int64_t((uint64_t(ntp_frac) * 1000000000ULL) >> 32U);
+            mapping.rtp_ts = ReadBe32(data + 16);
+            mapping_.Store(mapping);
+            last_sr_ = (ntp_sec << 16U) | (ntp_frac >> 16U);
+            last_sr_recv_ns_ = now_ns;
+            has_sr = true;
+        }
+        data += len;
+        size -= len;
+    }
+    return has_sr;
+}
+
+size_t RtcpSession::BuildReceiverReport(uint8_t *data, size_t size, int64_t now_ns) {
+    if (!has_rtp_ || size < kReceiverReportSize) {
+        return 0;
+    }
+    // RFC 3550 A.3
+    uint32_t extended_max = cycles_ + max_seq_;
+    uint32_t expected = extended_max - base_seq_ + 1;
+    int32_t lost = int32_t(expected - received_);
+    if (lost > 0x7fffff) {
+        lost = 0x7fffff;
+    } else if (lost < -0x800000) {
+        lost = -0x800000;
+    }
+    uint32_t expected_interval = expected - expected_prior_;
+    uint32_t received_interval = received_ - received_prior_;
+    expected_prior_ = expected;
+    received_prior_ = received_;
+    int32_t lost_interval = int32_t(expected_interval - received_interval);
+    uint8_t fraction = 0;
+    if (expected_interval && lost_interval > 0) {
+        fraction = uint8_t((uint32_t(lost_interval) << 8U) / expected_interval);
+    }
+    uint32_t dlsr = 0;
+    if (last_sr_) {
+        dlsr = uint32_t((now_ns - last_sr_recv_ns_) * 65536 / 1000000000LL);
+    }
+
+    data[0] = 0x81; // V=2, P=0, RC=1
+    data[1] = kRtcpReceiverReport;
+    WriteBe16(data + 2, kReceiverReportSize / 4 - 1);
+    WriteBe32(data + 4, ssrc_);
+    WriteBe32(data + 8, sender_ssrc_);
+    WriteBe32(data + 12, (uint32_t(fraction) << 24U) | (uint32_t(lost) & 0xffffffU));
+    WriteBe32(data + 16, extended_max);
+    WriteBe32(data + 20, uint32_t(jitter_));
+    WriteBe32(data + 24, last_sr_);
+    WriteBe32(data + 28, dlsr);
+    return kReceiverReportSize;
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2020 Wenxin Wang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PULSERTP_RTCPSESSION_H
+#define PULSERTP_RTCPSESSION_H
+
+#include <cstddef>
+#include <cstdint>
+#include "SeqLock.h"
+
+// Wall clock time (ns since unix epoch) of an RTP timestamp, from the last sender report
+struct RtpClockMapping {
+    int64_t wall_ns;
+    uint32_t rtp_ts;
+};
+
+// Receiver side of RTCP (RFC 3550): parses sender reports and tracks reception statistics
+// to build receiver reports. Everything but GetMapping runs on the receive thread.
+class RtcpSession {
+public:
+    explicit RtcpSession(unsigned clock_rate);
+
+    void OnRtp(const uint8_t *header, int64_t now_ns);
+
+    // Returns true if a sender report of the RTP sender was found
+    bool OnRtcp(const uint8_t *data, size_t size, int64_t now_ns);
+
+    // Returns the size of the report written to data, 0 if nothing to report yet
+    size_t BuildReceiverReport(uint8_t *data, size_t size, int64_t now_ns);
+
+    bool GetMapping(RtpClockMapping *mapping) const { return mapping_.Load(mapping); }
+
+    unsigned clock_rate() const { return clock_rate_; }
+
+private:
+    const unsigned clock_rate_;
+    const uint32_t ssrc_;
+
+    bool has_rtp_ = false;
+    uint32_t sender_ssrc_ = 0;
+    uint16_t max_seq_ = 0;
+    uint32_t cycles_ = 0;
+    uint32_t base_seq_ = 0;
+    uint32_t received_ = 0;
+    uint32_t expected_prior_ = 0;
+    uint32_t received_prior_ = 0;
+    double transit_ = 0;
+    double jitter_ = 0;
+
+    uint32_t last_sr_ = 0;
+    int64_t last_sr_recv_ns_ = 0;
+
+    SeqLock<RtpClockMapping> mapping_;
+};
+
+#endif //PULSERTP_RTCPSESSION_H
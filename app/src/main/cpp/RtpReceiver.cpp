@@ -0,0 +1,472 @@
+/*
+ * Copyright 2020 Wenxin Wang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "RtpReceiver.h"
+#include "RtCheck.h"
+#include "Tracing.h"
+#include <android/log.h>
+#include <logging_macros.h>
+#include <chrono>
+#include <cstring>
+#include <utility>
+
+namespace {
+    const unsigned kRtpHeader = 12;
+    // static const unsigned kNumChannel = 2;
+    const unsigned kSampleSize = 2;
+    // static const unsigned kSampleRate = 48000;
+    // static const unsigned kMaxLatency = 200;
+    const unsigned kIdleRecvMs = 10000;
+    const unsigned kRtcpReportMs = 5000;
+    const unsigned kSyncUpdateMs = 100;
+    // Sockets and timers are only touched on the receive thread, so only Stop() from another
+    // thread needs a lock; the per-packet re-arm then takes none
+    const int kConcurrencyHint =
+            static_cast<int>(ASIO_CONCURRENCY_HINT_ID | ASIO_CONCURRENCY_HINT_LOCKING_SCHEDULER);
+
+    int64_t SteadyNowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    bool IsAudible(const char *payload, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            if (payload[i]) {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+PacketBuffer::PacketBuffer(
+        unsigned mtu, unsigned sample_rate, unsigned max_latency, unsigned num_channel)
+        : tail_(0), size_(0), head_move_req_(0), head_move_(0), tail_move_req_(0),
+          tail_move_(0) {
+    const unsigned num_buffer = (1 + sample_rate * max_latency / 1000 /
+                                     (mtu / num_channel / kSampleSize));
+    // Nothing read yet: the slot before the first one written
+    head_.store(num_buffer - 1);
+    pkts_.reserve(num_buffer);
+    for (unsigned i = 0; i < num_buffer; ++i) {
+        pkts_.emplace_back(mtu / kSampleSize, 0);
+    }
+    timestamps_.resize(num_buffer, 0);
+}
+
+const std::vector<int16_t> *PacketBuffer::RefNextHeadForRead() {
+    ++head_move_req_;
+    auto head = head_.load(), tail = tail_.load();
+    if (++head >= pkts_.size()) {
+        head = 0;
+    }
+    // tail is where the next packet will be written
+    if (head == tail) {
+        TRACE_INSTANT("PacketBuffer::PopEmpty");
+        return nullptr;
+    }
+    head_.store(head);
+    ++head_move_;
+    --size_;
+    TRACE_COUNTER("PacketBuffer::size", size_);
+    return &pkts_[head];
+}
+
+std::vector<int16_t> *PacketBuffer::RefTailForWrite() {
+    auto tail = tail_.load();
+    return &pkts_[tail];
+}
+
+bool PacketBuffer::NextTail() {
+    ++tail_move_req_;
+    auto head = head_.load(), tail = tail_.load();
+    if (tail + 1 == head || (!head && tail == pkts_.size() - 1)) {
+        TRACE_INSTANT("PacketBuffer::PushFull");
+        return false;
+    }
+    if (++tail >= pkts_.size()) {
+        tail = 0;
+    }
+    tail_.store(tail);
+    ++tail_move_;
+    ++size_;
+    TRACE_COUNTER("PacketBuffer::size", size_);
+    return true;
+}
+
+RtpReceiveThread::RtpReceiveThread(PacketBuffer &pkt_buffer, RtLog &rt_log,
+                                   std::string ip, uint16_t port, unsigned mtu)
+        : pkt_buffer_(pkt_buffer), rt_log_(rt_log),
+          io_(kConcurrencyHint), ip_(std::move(ip)), port_(port), socket_(io_),
+          data_(kRtpHeader + mtu), idle_check_timer_(io_), drain_timer_(io_),
+          suspend_check_timer_(io_), is_suspended_(false), rtcp_socket_(io_),
+          rtcp_data_(kRtpHeader + mtu), report_timer_(io_), sync_timer_(io_) {
+}
+
+// borrowed from oboe samples
+void setThreadAffinity() {
+    pid_t current_thread_id = gettid();
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+
+    // If the callback cpu ids aren't specified then bind to the current cpu
+    int current_cpu_id = sched_getcpu();
+    LOGI("Binding to current CPU ID %d", current_cpu_id);
+    CPU_SET(current_cpu_id, &cpu_set);
+    // nproc = sysconf(_SC_NPROCESSORS_ONLN);
+    int result = sched_setaffinity(current_thread_id, sizeof(cpu_set_t), &cpu_set);
+    if (result == 0) {
+        LOGV("Thread affinity set");
+    } else {
+        LOGW("Error setting thread affinity. Error no: %d", result);
+    }
+}
+
+RtpReceiveThread::~RtpReceiveThread() {
+    Stop();
+}
+
+bool RtpReceiveThread::Start(unsigned coalesce_ms, unsigned suspend_idle_ms,
+                             std::function<void()> on_suspend,
+                             std::function<void()> on_resume,
+                             RtcpSession *rtcp, std::function<void()> on_sync) {
+    coalesce_ms_ = coalesce_ms;
+    suspend_idle_ms_ = suspend_idle_ms;
+    on_suspend_ = std::move(on_suspend);
+    on_resume_ = std::move(on_resume);
+    rtcp_ = rtcp;
+    on_sync_ = std::move(on_sync);
+    last_audible_ = std::chrono::steady_clock::now();
+
+    std::mutex start_mutex;
+    std::condition_variable start_cv;
+    int start_success = 0;
+
+    thread_ = std::thread([this, &start_mutex, &start_cv, &start_success]() {
+        setThreadAffinity();
+        TRACE_REGISTER_THREAD();
+        bool has_error = false;
+        try {
+            Restart();
+            ArmSuspendCheck();
+            ArmReceiverReport();
+            ArmSyncUpdate();
+        } catch (asio::system_error &e) {
+            LOGE("Failed to start receive thread, %s", e.what());
+            has_error = true;
+        }
+        {
+            std::unique_lock<std::mutex> lk(start_mutex);
+            start_success = has_error ? 2 : 1;
+            start_cv.notify_all();
+        }
+        if (has_error) {
+            return;
+        }
+        LOGI("Start Receiving");
+        io_.run();
+        LOGI("Stop Receiving");
+    });
+    std::unique_lock<std::mutex> lk(start_mutex);
+    start_cv.wait(lk, [&] { return start_success != 0; });
+    return start_success == 1;
+}
+
+void RtpReceiveThread::Stop() {
+    io_.stop();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void RtpReceiveThread::Restart() {
+    LOGE("Restart");
+    is_idle_ = false;
+    is_draining_ = false;
+    socket_.close();
+    socket_ = asio::ip::udp::socket(io_);
+    auto local_address = asio::ip::address::from_string(ip_);
+    bool is_mcast = local_address.is_multicast();
+    auto listen_address = local_address;
+    if (is_mcast) {
+        if (local_address.is_v4()) {
+            listen_address = asio::ip::address::from_string("0.0.0.0");
+        } else if (local_address.is_v6()) {
+            listen_address = asio::ip::address::from_string("::");
+        }
+    }
+    LOGI("Listening on %s %s:%u", ip_.c_str(), listen_address.to_string().c_str(), port_);
+    // Create the socket so that multiple may be bound to the same address.
+    asio::ip::udp::endpoint listen_endpoint(listen_address, port_);
+    socket_.open(listen_endpoint.protocol());
+    if (is_mcast) {
+        socket_.set_option(asio::ip::udp::socket::reuse_address(true));
+    }
+    socket_.bind(listen_endpoint);
+
+    // Join the multicast group.
+    if (is_mcast) {
+        socket_.set_option(asio::ip::multicast::join_group(local_address));
+    }
+
+    if (coalesce_ms_) {
+        // Packets queue up in the kernel between drains, let it hold the whole packet buffer.
+        socket_.set_option(asio::socket_base::receive_buffer_size(
+                int(pkt_buffer_.capacity() * data_.size())));
+        socket_.non_blocking(true);
+    }
+
+    if (rtcp_) {
+        StartRtcp(listen_address, local_address);
+    }
+
+    ArmIdleCheck();
+    StartReceive();
+}
+
+void RtpReceiveThread::StartRtcp(const asio::ip::address &listen_address,
+                                 const asio::ip::address &local_address) {
+    rtcp_socket_.close();
+    rtcp_socket_ = asio::ip::udp::socket(io_);
+    asio::ip::udp::endpoint listen_endpoint(listen_address, port_ + 1);
+    rtcp_socket_.open(listen_endpoint.protocol());
+    // Always shared, so that senders and receivers can be tested on the same host
+    rtcp_socket_.set_option(asio::ip::udp::socket::reuse_address(true));
+    rtcp_socket_.bind(listen_endpoint);
+    if (local_address.is_multicast()) {
+        rtcp_socket_.set_option(asio::ip::multicast::join_group(local_address));
+    }
+    StartRtcpReceive();
+}
+
+void RtpReceiveThread::StartRtcpReceive() {
+    rtcp_socket_.async_receive_from(
+            asio::buffer(rtcp_data_), rtcp_sender_endpoint_,
+            [&](const asio::error_code &error, size_t bytes_recvd) {
+                if (error && error != asio::error::message_size) {
+                    return;
+                }
+                if (rtcp_->OnRtcp(rtcp_data_.data(), bytes_recvd, SteadyNowNs())) {
+                    rtcp_report_endpoint_ = rtcp_sender_endpoint_;
+                }
+                StartRtcpReceive();
+            });
+}
+
+void RtpReceiveThread::ArmReceiverReport() {
+    if (!rtcp_) {
+        return;
+    }
+    report_timer_.expires_from_now(std::chrono::milliseconds(kRtcpReportMs));
+    report_timer_.async_wait([&](const asio::error_code &error) {
+        if (error) {
+            return;
+        }
+        uint8_t report[64];
+        size_t size = rtcp_->BuildReceiverReport(report, sizeof(report), SteadyNowNs());
+        if (size && rtcp_report_endpoint_.port()) {
+            asio::error_code send_error;
+            rtcp_socket_.send_to(asio::buffer(report, size), rtcp_report_endpoint_, 0,
+                                 send_error);
+            if (send_error) {
+                LOGE("Failed to send receiver report, %s", send_error.message().c_str());
+            }
+        }
+        ArmReceiverReport();
+    });
+}
+
+void RtpReceiveThread::ArmSyncUpdate() {
+    if (!rtcp_) {
+        return;
+    }
+    sync_timer_.expires_from_now(std::chrono::milliseconds(kSyncUpdateMs));
+    sync_timer_.async_wait([&](const asio::error_code &error) {
+        if (error) {
+            return;
+        }
+        on_sync_();
+        // Nothing is played while suspended, ContinueReceive re-arms on resume
+        if (!is_suspended_) {
+            ArmSyncUpdate();
+        }
+    });
+}
+
+void RtpReceiveThread::StartReceive() {
+    if (coalesce_ms_ && is_draining_) {
+        drain_timer_.expires_from_now(std::chrono::milliseconds(coalesce_ms_));
+        drain_timer_.async_wait([&](const asio::error_code &error) {
+            if (error) {
+                return;
+            }
+            DrainSocket();
+        });
+        return;
+    }
+    if (coalesce_ms_) {
+        // Nothing is arriving, e.g. idle or suspended: sleep until a packet does
+        socket_.async_wait(asio::ip::udp::socket::wait_read, [&](const asio::error_code &error) {
+            if (error) {
+                return;
+            }
+            DrainSocket();
+        });
+        return;
+    }
+    socket_.async_receive_from(
+            asio::buffer(data_), sender_endpoint_,
+            [&](const asio::error_code &error, size_t bytes_recvd) {
+                if (error && error != asio::error::message_size) {
+                    return;
+                }
+                bool is_resumed;
+                {
+                    // Re-arming the receive happens for every packet as well
+                    RT_SECTION();
+                    if (error == asio::error::message_size) {
+                        RT_LOGE(rt_log_, "Long packet");
+                    }
+                    is_resumed = PushPacket(bytes_recvd);
+                    if (!is_resumed && !is_idle_) {
+                        StartReceive();
+                        return;
+                    }
+                }
+                ContinueReceive(is_resumed);
+            });
+}
+
+void RtpReceiveThread::ContinueReceive(bool is_resumed) {
+    if (is_resumed) {
+        LOGI("Resume on audible packet");
+        on_resume_();
+        ArmSyncUpdate();
+    }
+    if (is_idle_) {
+        Restart();
+    } else {
+        StartReceive();
+    }
+}
+
+void RtpReceiveThread::DrainSocket() {
+    bool is_resumed = false;
+    unsigned num_pkt = 0;
+    {
+        RT_SECTION();
+        TRACE_SCOPE("RtpReceiveThread::DrainSocket");
+        while (true) {
+            asio::error_code error;
+            size_t bytes_recvd = socket_.receive_from(
+                    asio::buffer(data_), sender_endpoint_, 0, error);
+            if (error == asio::error::would_block) {
+                break;
+            }
+            if (error && error != asio::error::message_size) {
+                RT_LOGE(rt_log_, "Failed to drain socket, %d", error.value());
+                break;
+            }
+            if (error == asio::error::message_size) {
+                RT_LOGE(rt_log_, "Long packet");
+            }
+            is_resumed = PushPacket(bytes_recvd) || is_resumed;
+            ++num_pkt;
+        }
+        // Keep draining on the timer until a drain comes back empty
+        is_draining_ = num_pkt != 0;
+        // While idle, only a packet restarts the socket
+        if (!is_resumed && (!is_idle_ || !num_pkt)) {
+            StartReceive();
+            return;
+        }
+    }
+    ContinueReceive(is_resumed);
+}
+
+void RtpReceiveThread::ArmIdleCheck() {
+    // Check periodically instead of re-arming for every packet
+    idle_check_pkt_recved_ = pkt_recved_;
+    idle_check_timer_.expires_from_now(std::chrono::milliseconds(kIdleRecvMs));
+    idle_check_timer_.async_wait([&](const asio::error_code &error) {
+        if (error) {
+            return;
+        }
+        if (pkt_recved_ != idle_check_pkt_recved_) {
+            ArmIdleCheck();
+            return;
+        }
+        is_idle_ = true;
+        LOGE("Is Idle Now");
+    });
+}
+
+void RtpReceiveThread::ArmSuspendCheck() {
+    if (!suspend_idle_ms_) {
+        return;
+    }
+    suspend_check_timer_.expires_from_now(std::chrono::milliseconds(suspend_idle_ms_ / 4 + 1));
+    suspend_check_timer_.async_wait([&](const asio::error_code &error) {
+        if (error) {
+            return;
+        }
+        auto idle = std::chrono::steady_clock::now() - last_audible_;
+        if (!is_suspended_ && idle >= std::chrono::milliseconds(suspend_idle_ms_)) {
+            LOGI("Suspend after %u ms without audio", suspend_idle_ms_);
+            is_suspended_ = true;
+            on_suspend_();
+        }
+        ArmSuspendCheck();
+    });
+}
+
+bool RtpReceiveThread::PushPacket(size_t bytes_recvd) {
+    TRACE_SCOPE("RtpReceiveThread::PushPacket");
+    pkt_recved_++;
+    if (bytes_recvd <= kRtpHeader) {
+        RT_LOGE(rt_log_, "Packet Too Small");
+        return false;
+    } else if (bytes_recvd != data_.size()) {
+        RT_LOGE(rt_log_, "Strange packet %zu", bytes_recvd);
+    }
+    auto header = reinterpret_cast<const uint8_t *>(data_.data());
+    if (rtcp_) {
+        rtcp_->OnRtp(header, SteadyNowNs());
+    }
+    bool is_resumed = false;
+    if (suspend_idle_ms_) {
+        if (IsAudible(data_.data() + kRtpHeader, bytes_recvd - kRtpHeader)) {
+            last_audible_ = std::chrono::steady_clock::now();
+            if (is_suspended_) {
+                is_suspended_ = false;
+                is_resumed = true;
+            }
+        } else if (is_suspended_) {
+            // Nobody is reading, don't fill the buffer with silence
+            return false;
+        }
+    }
+    auto vec = pkt_buffer_.RefTailForWrite();
+    // Never reallocates, packets are at most mtu long, which is what the buffer reserved
+    vec->resize((bytes_recvd - kRtpHeader) / kSampleSize);
+    auto buffer = vec->data();
+    std::memcpy(buffer, data_.data() + kRtpHeader, bytes_recvd - kRtpHeader);
+    pkt_buffer_.SetTailTimestamp(ntohl(*reinterpret_cast<const uint32_t *>(header + 4)));
+    if (!pkt_buffer_.NextTail()) {
+        // LOGE("Packet Buffer Full");
+    }
+    return is_resumed;
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright 2020 Wenxin Wang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PULSERTP_RTPRECEIVER_H
+#define PULSERTP_RTPRECEIVER_H
+
+#include <cstdint>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <asio.hpp>
+#include "RtcpSession.h"
+#include "RtLog.h"
+
+#define MODULE_NAME "PULSE_RTP_OBOE_ENGINE"
+
+// MTU: 1280, channel 2, sample se16e -> 320 sample per pkt
+// 48k sample per s -> 150 pkt/s
+// 100ms buffer: 15pkt
+// RTP payload: 1280 + 12 = 1292
+
+class PacketBuffer {
+public:
+    PacketBuffer(unsigned mtu, unsigned sample_rate, unsigned max_latency, unsigned num_channel);
+
+    const std::vector<int16_t> *RefNextHeadForRead();
+
+    std::vector<int16_t> *RefTailForWrite();
+
+    void SetTailTimestamp(uint32_t rtp_ts) { timestamps_[tail_.load()] = rtp_ts; }
+
+    bool NextTail();
+
+    // RTP timestamp of the packet last returned by RefNextHeadForRead
+    uint32_t head_timestamp() const { return timestamps_[head_.load()]; }
+
+    unsigned capacity() const { return pkts_.size(); }
+
+    unsigned size() const { return size_; }
+
+    unsigned head_move_req() const { return head_move_req_; }
+
+    unsigned head_move() const { return head_move_; }
+
+    unsigned tail_move_req() const { return tail_move_req_; }
+
+    unsigned tail_move() const { return tail_move_; }
+
+private:
+    std::vector<std::vector<int16_t>> pkts_;
+    std::vector<uint32_t> timestamps_;
+    // The slot last returned for reading, which the writer must not touch
+    std::atomic<unsigned> head_;
+    // The slot being written, published by NextTail
+    std::atomic<unsigned> tail_;
+    std::atomic<unsigned> size_;
+
+    std::atomic<unsigned> head_move_req_;
+    std::atomic<unsigned> head_move_;
+    std::atomic<unsigned> tail_move_req_;
+    std::atomic<unsigned> tail_move_;
+};
+
+class RtpReceiveThread {
+public:
+    RtpReceiveThread(PacketBuffer &pkt_buffer, RtLog &rt_log, std::string ip, uint16_t port,
+                     unsigned mtu);
+
+    ~RtpReceiveThread();
+
+    // coalesce_ms: if non-zero, drain the socket every coalesce_ms instead of waking per packet,
+    // and wait for the next packet once a drain finds none.
+    // suspend_idle_ms: if non-zero, call on_suspend after that long without audible packets,
+    // and on_resume on the next audible one.
+    // rtcp: if not null, receive RTCP on port + 1, and call on_sync periodically.
+    // All callbacks are called on the receive thread.
+    bool Start(unsigned coalesce_ms, unsigned suspend_idle_ms,
+               std::function<void()> on_suspend, std::function<void()> on_resume,
+               RtcpSession *rtcp, std::function<void()> on_sync);
+
+    void Stop();
+
+    unsigned pkt_recved() const { return pkt_recved_; }
+
+    bool is_suspended() const { return is_suspended_; }
+
+    // Of the receive thread, valid between Start and Stop
+    std::thread::native_handle_type native_handle() { return thread_.native_handle(); }
+
+private:
+    void Restart();
+
+    void StartReceive();
+
+    // Off the per-packet path: resumes the stream and restarts the socket if needed
+    void ContinueReceive(bool is_resumed);
+
+    void DrainSocket();
+
+    void ArmIdleCheck();
+
+    void ArmSuspendCheck();
+
+    // Returns true if the packet resumed a suspended stream. Called in a real-time section.
+    bool PushPacket(size_t bytes_recvd);
+
+    void StartRtcp(const asio::ip::address &listen_address,
+                   const asio::ip::address &local_address);
+
+    void StartRtcpReceive();
+
+    void ArmReceiverReport();
+
+    void ArmSyncUpdate();
+
+    PacketBuffer &pkt_buffer_;
+    RtLog &rt_log_;
+    asio::io_context io_;
+    std::string ip_;
+    uint16_t port_;
+    asio::ip::udp::socket socket_;
+    asio::ip::udp::endpoint sender_endpoint_;
+    std::vector<char> data_;
+    asio::steady_timer idle_check_timer_;
+    asio::steady_timer drain_timer_;
+    asio::steady_timer suspend_check_timer_;
+    std::thread thread_;
+    bool is_idle_ = false;
+    unsigned pkt_recved_ = 0;
+    unsigned idle_check_pkt_recved_ = 0;
+
+    unsigned coalesce_ms_ = 0;
+    // Coalescing: drain on drain_timer_ while packets arrive, else wait for the socket
+    bool is_draining_ = false;
+    unsigned suspend_idle_ms_ = 0;
+    std::function<void()> on_suspend_;
+    std::function<void()> on_resume_;
+    std::chrono::steady_clock::time_point last_audible_;
+    std::atomic<bool> is_suspended_;
+
+    RtcpSession *rtcp_ = nullptr;
+    std::function<void()> on_sync_;
+    asio::ip::udp::socket rtcp_socket_;
+    asio::ip::udp::endpoint rtcp_sender_endpoint_;
+    asio::ip::udp::endpoint rtcp_report_endpoint_;
+    std::vector<uint8_t> rtcp_data_;
+    asio::steady_timer report_timer_;
+    asio::steady_timer sync_timer_;
+};
+
+// Pins the calling thread to the CPU it is running on
+void setThreadAffinity();
+
+#endif //PULSERTP_RTPRECEIVER_H
@@ -0,0 +1,313 @@
+/*
+ * Copyright 2020 Wenxin Wang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define MODULE_NAME "PULSE_RTP_SAP"
+
+#include "SapDiscovery.h"
+#include <android/log.h>
+#include <logging_macros.h>
+#include <strings.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <utility>
+
+namespace {
+    // SAP packets should stay under 1kB, leave room for oversized ones
+    const size_t kMaxSapPacket = 4096;
+    const uint8_t kSapVersion = 1;
+    const uint8_t kSapAddressV6 = 0x10;
+    const uint8_t kSapDeletion = 0x04;
+    const uint8_t kSapEncrypted = 0x02;
+    const uint8_t kSapCompressed = 0x01;
+    const char kSdpMimeType[] = "application/sdp";
+    // PulseAudio announces every 5s
+    const unsigned kExpireMs = 30000;
+    const unsigned kExpireCheckMs = 5000;
+    // Wait before receiving again after an error, e.g. while the network is down
+    const unsigned kRetryMs = 1000;
+    // Static payload types from RFC 3551
+    const int kPayloadL16Stereo = 10;
+    const int kPayloadL16Mono = 11;
+    const unsigned kStaticL16Rate = 44100;
+    // Announcements are unauthenticated, anything outside these is not played
+    const unsigned kMinSampleRate = 8000;
+    const unsigned kMaxSampleRate = 192000;
+    const unsigned kMaxNumChannel = 8;
+
+    bool SameAddress(const std::string &a, const std::string &b) {
+        asio::error_code ec_a, ec_b;
+        auto addr_a = asio::ip::address::from_string(a, ec_a);
+        auto addr_b = asio::ip::address::from_string(b, ec_b);
+        if (ec_a || ec_b) {
+            return a == b;
+        }
+        return addr_a == addr_b;
+    }
+}
+
+bool ParseSdp(const char *data, size_t size, SdpStream *stream) {
+    SdpStream result;
+    bool has_media = false;
+    int payload_type = -1;
+    std::string encoding;
+    unsigned num_channel = 1;
+    const char *end = data + size;
+    while (data < end) {
+        const char *eol = std::find(data, end, '\n');
+        std::string line(data, eol);
+        data = eol == end ? end : eol + 1;
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.size() < 2 || line[1] != '=') {
+            continue;
+        }
+        std::string value = line.substr(2);
+        if (line[0] == 's') {
+            result.name = value;
+        } else if (line[0] == 'c') {
+            // c=IN IP4 224.0.0.56/255
+            std::istringstream in(value);
+            std::string net_type, addr_type, addr;
+            in >> net_type >> addr_type >> addr;
+            result.ip = addr.substr(0, addr.find('/'));
+        } else if (line[0] == 'm') {
+            if (has_media) {
+                // Only the first audio stream is played
+                break;
+            }
+            // m=audio 46000 RTP/AVP 127
+            std::istringstream in(value);
+            std::string media, port, proto;
+            in >> media >> port >> proto >> payload_type;
+            if (media != "audio" || proto != "RTP/AVP" || !in) {
+                return false;
+            }
+            unsigned long port_num = std::strtoul(port.c_str(), nullptr, 10);
+            if (port_num == 0 || port_num > 65535) {
+                return false;
+            }
+            result.port = uint16_t(port_num);
+            has_media = true;
+        } else if (line[0] == 'a' && has_media) {
+            // a=rtpmap:127 L16/48000/2, channels default to 1
+            int rtpmap_type = -1;
+            char rtpmap_encoding[32] = {};
+            unsigned rate = 0;
+            unsigned channels = 1;
+            if (std::sscanf(value.c_str(), "rtpmap:%d %31[^/]/%u/%u",
+                            &rtpmap_type, rtpmap_encoding, &rate, &channels) >= 3 &&
+                rtpmap_type == payload_type) {
+                encoding = rtpmap_encoding;
+                result.sample_rate = rate;
+                num_channel = channels;
+            }
+        }
+    }
+    if (!has_media || result.ip.empty()) {
+        return false;
+    }
+    if (encoding.empty()) {
+        if (payload_type != kPayloadL16Stereo && payload_type != kPayloadL16Mono) {
+            return false;
+        }
+        encoding = "L16";
+        result.sample_rate = kStaticL16Rate;
+        num_channel = payload_type == kPayloadL16Stereo ? 2 : 1;
+    }
+    if (strcasecmp(encoding.c_str(), "L16") != 0 ||
+        result.sample_rate < kMinSampleRate || result.sample_rate > kMaxSampleRate ||
+        num_channel == 0 || num_channel > kMaxNumChannel) {
+        return false;
+    }
+    result.num_channel = num_channel;
+    *stream = std::move(result);
+    return true;
+}
+
+SapDiscovery::SapDiscovery(std::string ip, uint16_t port)
+        : ip_(std::move(ip)), port_(port), socket_(io_), data_(kMaxSapPacket),
+          expire_timer_(io_), retry_timer_(io_) {
+}
+
+SapDiscovery::~SapDiscovery() {
+    Stop();
+}
+
+bool SapDiscovery::Start() {
+    if (!Restart()) {
+        return false;
+    }
+    ArmExpire();
+    thread_ = std::thread([this]() { io_.run(); });
+    return true;
+}
+
+bool SapDiscovery::Restart() {
+    try {
+        socket_.close();
+        socket_ = asio::ip::udp::socket(io_);
+        auto group_address = asio::ip::address::from_string(ip_);
+        auto listen_address = group_address.is_v6()
+                              ? asio::ip::address(asio::ip::address_v6::any())
+                              : asio::ip::address(asio::ip::address_v4::any());
+        asio::ip::udp::endpoint listen_endpoint(listen_address, port_);
+        socket_.open(listen_endpoint.protocol());
+        // Shared with other SAP listeners on the host, e.g. PulseAudio module-rtp-recv
+        socket_.set_option(asio::ip::udp::socket::reuse_address(true));
+        socket_.bind(listen_endpoint);
+        if (group_address.is_multicast()) {
+            socket_.set_option(asio::ip::multicast::join_group(group_address));
+        }
+    } catch (asio::system_error &e) {
+        LOGE("Failed to start discovery, %s", e.what());
+        return false;
+    }
+    LOGI("Listening for SAP on %s:%u", ip_.c_str(), port_);
+    last_receive_ = std::chrono::steady_clock::now();
+    StartReceive();
+    return true;
+}
+
+void SapDiscovery::Stop() {
+    io_.stop();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+std::vector<SdpStream> SapDiscovery::streams() const {
+    std::vector<SdpStream> result;
+    std::lock_guard<std::mutex> lk(mutex_);
+    result.reserve(streams_.size());
+    for (const auto &entry : streams_) {
+        result.push_back(entry.second.stream);
+    }
+    return result;
+}
+
+bool SapDiscovery::Find(const std::string &ip, uint16_t port, SdpStream *stream) const {
+    std::lock_guard<std::mutex> lk(mutex_);
+    for (const auto &entry : streams_) {
+        if (entry.second.stream.port == port && SameAddress(entry.second.stream.ip, ip)) {
+            *stream = entry.second.stream;
+            return true;
+        }
+    }
+    return false;
+}
+
+void SapDiscovery::StartReceive() {
+    socket_.async_receive_from(
+            asio::buffer(data_), sender_endpoint_,
+            [&](const asio::error_code &error, size_t bytes_recvd) {
+                if (error == asio::error::operation_aborted) {
+                    return;
+                }
+                if (error && error != asio::error::message_size) {
+                    LOGE("Failed to receive SAP, %s", error.message().c_str());
+                    retry_timer_.expires_from_now(std::chrono::milliseconds(kRetryMs));
+                    retry_timer_.async_wait([&](const asio::error_code &retry_error) {
+                        if (!retry_error) {
+                            StartReceive();
+                        }
+                    });
+                    return;
+                }
+                last_receive_ = std::chrono::steady_clock::now();
+                HandleReceive(bytes_recvd);
+                StartReceive();
+            });
+}
+
+void SapDiscovery::HandleReceive(size_t bytes_recvd) {
+    // RFC 2974: flags, auth length, msg id hash, originating source, auth data, payload
+    const auto *header = reinterpret_cast<const uint8_t *>(data_.data());
+    if (bytes_recvd < 4 || (header[0] >> 5U) != kSapVersion ||
+        (header[0] & (kSapEncrypted | kSapCompressed))) {
+        return;
+    }
+    size_t origin_size = (header[0] & kSapAddressV6) ? 16 : 4;
+    size_t offset = 4 + origin_size + size_t(header[1]) * 4;
+    if (bytes_recvd < offset) {
+        return;
+    }
+    std::string key(data_.data() + 2, 2 + origin_size);
+    if (header[0] & kSapDeletion) {
+        std::lock_guard<std::mutex> lk(mutex_);
+        auto it = streams_.find(key);
+        if (it != streams_.end()) {
+            LOGI("Stream %s deleted", it->second.stream.name.c_str());
+            streams_.erase(it);
+        }
+        return;
+    }
+
+    const char *payload = data_.data() + offset;
+    size_t size = bytes_recvd - offset;
+    // The payload type is optional, SDP is assumed if it is missing
+    if (size < 2 || std::strncmp(payload, "v=", 2) != 0) {
+        const auto *type_end = static_cast<const char *>(std::memchr(payload, 0, size));
+        if (!type_end || std::strcmp(payload, kSdpMimeType) != 0) {
+            return;
+        }
+        size -= type_end + 1 - payload;
+        payload = type_end + 1;
+    }
+    SdpStream stream;
+    if (!ParseSdp(payload, size, &stream)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lk(mutex_);
+    auto &entry = streams_[key];
+    if (entry.stream.port == 0) {
+        LOGI("Found stream %s at %s:%u, %uHz %u channels", stream.name.c_str(),
+             stream.ip.c_str(), stream.port, stream.sample_rate, stream.num_channel);
+    }
+    entry.stream = std::move(stream);
+    entry.last_seen = std::chrono::steady_clock::now();
+}
+
+void SapDiscovery::ArmExpire() {
+    expire_timer_.expires_from_now(std::chrono::milliseconds(kExpireCheckMs));
+    expire_timer_.async_wait([&](const asio::error_code &error) {
+        if (error) {
+            return;
+        }
+        auto expired = std::chrono::steady_clock::now() - std::chrono::milliseconds(kExpireMs);
+        if (last_receive_ < expired) {
+            // The group membership may have been lost with the network, e.g. on a Wi-Fi
+            // reconnect. Rejoin, and try again on the next check if that fails.
+            LOGI("No announcement for %u ms, restart", kExpireMs);
+            Restart();
+        }
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            for (auto it = streams_.begin(); it != streams_.end();) {
+                if (it->second.last_seen < expired) {
+                    LOGI("Stream %s expired", it->second.stream.name.c_str());
+                    it = streams_.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        ArmExpire();
+    });
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright 2020 Wenxin Wang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PULSERTP_SAPDISCOVERY_H
+#define PULSERTP_SAPDISCOVERY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <asio.hpp>
+
+// An L16 stream described by SDP
+struct SdpStream {
+    std::string name;
+    std::string ip;
+    uint16_t port = 0;
+    unsigned sample_rate = 0;
+    unsigned num_channel = 0;
+};
+
+// Returns false if the SDP is malformed or does not describe an L16 audio stream
+bool ParseSdp(const char *data, size_t size, SdpStream *stream);
+
+// Listens for SAP (RFC 2974) announcements, as sent by PulseAudio module-rtp-send, and keeps
+// the streams announced recently. Streams are updated on the discovery thread, and may be
+// read from any thread.
+class SapDiscovery {
+public:
+    // PulseAudio announces on 224.0.0.56:9875 by default
+    explicit SapDiscovery(std::string ip = "224.0.0.56", uint16_t port = 9875);
+
+    ~SapDiscovery();
+
+    bool Start();
+
+    void Stop();
+
+    std::vector<SdpStream> streams() const;
+
+    // Returns false if no stream is announced on ip:port
+    bool Find(const std::string &ip, uint16_t port, SdpStream *stream) const;
+
+private:
+    struct Entry {
+        SdpStream stream;
+        std::chrono::steady_clock::time_point last_seen;
+    };
+
+    // (Re)opens the socket and joins the group. Returns false on error.
+    bool Restart();
+
+    void StartReceive();
+
+    void HandleReceive(size_t bytes_recvd);
+
+    void ArmExpire();
+
+    asio::io_context io_;
+    std::string ip_;
+    uint16_t port_;
+    asio::ip::udp::socket socket_;
+    asio::ip::udp::endpoint sender_endpoint_;
+    std::vector<char> data_;
+    asio::steady_timer expire_timer_;
+    asio::steady_timer retry_timer_;
+    // Only used on the discovery thread
+    std::chrono::steady_clock::time_point last_receive_;
+    std::thread thread_;
+
+    // Keyed by originating source and message id hash
+    mutable std::mutex mutex_;
+    std::map<std::string, Entry> streams_;
+};
+
+#endif //PULSERTP_SAPDISCOVERY_H
@@ -0,0 +1,52 @@
+/*
+ * Copyright 2020 Wenxin Wang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PULSERTP_SEQLOCK_H
+#define PULSERTP_SEQLOCK_H
+
+#include <atomic>
+
+// Single writer, many readers. Readers retry if they raced with the writer, so neither
+// side ever blocks, which makes it usable from the audio callback.
+template<typename T>
+class SeqLock {
+public:
+    void Store(const T &value) {
+        seq_.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        value_ = value;
+        std::atomic_thread_fence(std::memory_order_release);
+        seq_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // Returns false if nothing was stored yet
+    bool Load(T *value) const {
+        unsigned seq0, seq1;
+        do {
+            seq0 = seq_.load(std::memory_order_acquire);
+            *value = value_;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            seq1 = seq_.load(std::memory_order_relaxed);
+        } while (seq0 != seq1 || (seq0 & 1U));
+        return seq0 != 0;
+    }
+
+private:
+    std::atomic<unsigned> seq_{0};
+    T value_{};
+};
+
+#endif //PULSERTP_SEQLOCK_H
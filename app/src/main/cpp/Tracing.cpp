@@ -0,0 +1,230 @@
+/*
+ * Copyright 2020 Wenxin Wang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Tracing.h"
+
+#ifdef PULSERTP_TRACE
+
+#include <cstdlib>
+
+#ifdef __ANDROID__
+
+#include <dlfcn.h>
+
+namespace {
+    // ATrace is only in the NDK from API 23 (counters from 29), so load it at runtime,
+    // like oboe's debug-utils does
+    struct ATraceApi {
+        void (*begin_section)(const char *) = nullptr;
+        void (*end_section)() = nullptr;
+        bool (*is_enabled)() = nullptr;
+        void (*set_counter)(const char *, int64_t) = nullptr;
+
+        ATraceApi() {
+            void *lib = dlopen("libandroid.so", RTLD_NOW | RTLD_LOCAL);
+            if (!lib) {
+                return;
+            }
+            begin_section = reinterpret_cast<decltype(begin_section)>(
+                    dlsym(lib, "ATrace_beginSection"));
+            end_section = reinterpret_cast<decltype(end_section)>(
+                    dlsym(lib, "ATrace_endSection"));
+            is_enabled = reinterpret_cast<decltype(is_enabled)>(
+                    dlsym(lib, "ATrace_isEnabled"));
+            set_counter = reinterpret_cast<decltype(set_counter)>(
+                    dlsym(lib, "ATrace_setCounter"));
+            if (!begin_section || !end_section || !is_enabled) {
+                begin_section = nullptr;
+            }
+        }
+    };
+
+    const ATraceApi &Api() {
+        static ATraceApi api;
+        return api;
+    }
+}
+
+void trace::RegisterThread() {
+    // Loads ATrace on the first call
+    Api();
+}
+
+void trace::Begin(const char *name) {
+    auto &api = Api();
+    if (api.begin_section && api.is_enabled()) {
+        api.begin_section(name);
+    }
+}
+
+void trace::End() {
+    auto &api = Api();
+    if (api.begin_section && api.is_enabled()) {
+        api.end_section();
+    }
+}
+
+void trace::Instant(const char *name) {
+    Begin(name);
+    End();
+}
+
+void trace::Counter(const char *name, int64_t value) {
+    auto &api = Api();
+    if (api.set_counter && api.is_enabled()) {
+        api.set_counter(name, value);
+    }
+}
+
+bool trace::Dump(const char *path) {
+    return false;
+}
+
+#else
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+    const size_t kEventsPerThread = 1U << 18U;
+
+    struct Event {
+        const char *name;
+        int64_t ts_ns;
+        int64_t value;
+        char phase;
+    };
+
+    // A ring only written by its own thread, read by Dump. Once full, the oldest events are
+    // overwritten, so a dump has the most recent kEventsPerThread events.
+    struct ThreadBuffer {
+        explicit ThreadBuffer(unsigned tid) : events(kEventsPerThread), tid(tid) {}
+
+        std::vector<Event> events;
+        // Events ever recorded; the next one goes to size % events.size()
+        std::atomic<size_t> size{0};
+        const unsigned tid;
+    };
+
+    std::mutex registry_mutex;
+    // Never freed, so that events of exited threads can still be dumped
+    std::vector<std::unique_ptr<ThreadBuffer>> registry;
+    thread_local ThreadBuffer *thread_buffer = nullptr;
+    std::atomic<unsigned> unregistered_dropped{0};
+
+    void Record(char phase, const char *name, int64_t value) {
+        auto buffer = thread_buffer;
+        if (!buffer) {
+            ++unregistered_dropped;
+            return;
+        }
+        size_t size = buffer->size.load(std::memory_order_relaxed);
+        auto ts_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        buffer->events[size % buffer->events.size()] = Event{name, ts_ns, value, phase};
+        buffer->size.store(size + 1, std::memory_order_release);
+    }
+}
+
+void trace::RegisterThread() {
+    if (thread_buffer) {
+        return;
+    }
+    std::lock_guard<std::mutex> lk(registry_mutex);
+    registry.emplace_back(new ThreadBuffer(unsigned(registry.size()) + 1));
+    thread_buffer = registry.back().get();
+}
+
+void trace::Begin(const char *name) {
+    Record('B', name, 0);
+}
+
+void trace::End() {
+    Record('E', "", 0);
+}
+
+void trace::Instant(const char *name) {
+    Record('i', name, 0);
+}
+
+void trace::Counter(const char *name, int64_t value) {
+    Record('C', name, value);
+}
+
+bool trace::Dump(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+    fprintf(file, "{\"traceEvents\":[");
+    bool is_first = true;
+    std::lock_guard<std::mutex> lk(registry_mutex);
+    for (auto &buffer : registry) {
+        size_t size = buffer->size.load(std::memory_order_acquire);
+        size_t capacity = buffer->events.size();
+        size_t overwritten = size > capacity ? size - capacity : 0;
+        // Ends whose begin was overwritten would close scopes that were never opened
+        unsigned depth = 0;
+        for (size_t i = overwritten; i < size; ++i) {
+            const Event &event = buffer->events[i % capacity];
+            if (event.phase == 'B') {
+                ++depth;
+            } else if (event.phase == 'E') {
+                if (!depth) {
+                    continue;
+                }
+                --depth;
+            }
+            fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lld.%03lld,"
+                          "\"pid\":1,\"tid\":%u",
+                    is_first ? "" : ",", event.name, event.phase,
+                    (long long) (event.ts_ns / 1000), (long long) (event.ts_ns % 1000),
+                    buffer->tid);
+            if (event.phase == 'C') {
+                fprintf(file, ",\"args\":{\"%s\":%lld}", event.name, (long long) event.value);
+            } else if (event.phase == 'i') {
+                fprintf(file, ",\"s\":\"t\"");
+            }
+            fprintf(file, "}");
+            is_first = false;
+        }
+        if (overwritten) {
+            fprintf(stderr, "trace: thread %u overwrote its oldest %zu events\n", buffer->tid,
+                    overwritten);
+        }
+    }
+    if (unregistered_dropped) {
+        fprintf(stderr, "trace: dropped %u events of unregistered threads\n",
+                unsigned(unregistered_dropped));
+    }
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
+
+#endif // __ANDROID__
+
+void trace::DumpIfRequested() {
+    const char *path = getenv("PULSERTP_TRACE_FILE");
+    if (path && *path) {
+        Dump(path);
+    }
+}
+
+#endif // PULSERTP_TRACE
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2020 Wenxin Wang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PULSERTP_TRACING_H
+#define PULSERTP_TRACING_H
+
+// Tracing of the receive and playout paths. Only compiled in with PULSERTP_TRACE, otherwise
+// the macros expand to nothing, and their arguments are type-checked but not evaluated.
+// Names must be string literals.
+//
+// On Android, events go to ATrace (systrace/Perfetto). Elsewhere, each thread records into
+// its own fixed-size buffer, written out as Chrome JSON (chrome://tracing, ui.perfetto.dev)
+// by trace::Dump. Threads register with TRACE_REGISTER_THREAD before their first real-time
+// section, so recording never allocates; events of unregistered threads are dropped.
+#ifdef PULSERTP_TRACE
+
+#include <cstdint>
+
+namespace trace {
+    // Sets up tracing for the calling thread, does nothing if it already is
+    void RegisterThread();
+
+    void Begin(const char *name);
+
+    void End();
+
+    void Instant(const char *name);
+
+    void Counter(const char *name, int64_t value);
+
+    // Writes the last 2^18 events of each thread to path, does nothing on Android.
+    // Should be called when the traced threads are stopped.
+    bool Dump(const char *path);
+
+    // Dumps to $PULSERTP_TRACE_FILE if set
+    void DumpIfRequested();
+
+    class Scope {
+    public:
+        explicit Scope(const char *name) { Begin(name); }
+
+        ~Scope() { End(); }
+
+        Scope(const Scope &) = delete;
+
+        Scope &operator=(const Scope &) = delete;
+    };
+}
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_REGISTER_THREAD() trace::RegisterThread()
+#define TRACE_SCOPE(name) trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_INSTANT(name) trace::Instant(name)
+#define TRACE_COUNTER(name, value) trace::Counter(name, int64_t(value))
+#define TRACE_DUMP() trace::DumpIfRequested()
+
+#else
+
+#define TRACE_REGISTER_THREAD() do {} while (0)
+#define TRACE_SCOPE(name) do { (void) sizeof(name); } while (0)
+#define TRACE_INSTANT(name) do { (void) sizeof(name); } while (0)
+#define TRACE_COUNTER(name, value) do { (void) sizeof(name); (void) sizeof(value); } while (0)
+#define TRACE_DUMP() do {} while (0)
+
+#endif // PULSERTP_TRACE
+
+#endif //PULSERTP_TRACING_H
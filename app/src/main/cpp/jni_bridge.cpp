@@ -17,6 +17,7 @@
 #include <jni.h>
 #include <oboe/Oboe.h>
 #include "PulseRtpOboeEngine.h"
+#include "SapDiscovery.h"
 #include <logging_macros.h>
 
 extern "C" {
@@ -30,13 +31,41 @@ Java_me_wenxinwang_pulsedroidrtp_PulseRtpAudioEngine_native_1createEngine(
         jint mtu,
         jint max_latency,
         jint num_channel,
-        jint mask_channel) {
+        jint mask_channel,
+        jint suspend_idle,
+        jint sync_delay,
+        jint sample_rate,
+        jlong discoveryHandle) {
     // We use std::nothrow so `new` returns a nullptr if the engine creation fails
     const char *ip_c = env->GetStringUTFChars(jip, 0);
     std::string ip(ip_c);
     env->ReleaseStringUTFChars(jip, ip_c);
+    // If the stream is announced, its SDP wins over what was configured
+    SdpStream stream;
+    bool is_announced = discoveryHandle &&
+            reinterpret_cast<SapDiscovery *>(discoveryHandle)->Find(ip, (uint16_t) port, &stream);
+    if (is_announced && stream.num_channel * sizeof(int16_t) > unsigned(mtu)) {
+        LOGW("Ignoring announcement of %s:%d, a frame of %u channels does not fit mtu %d",
+             ip.c_str(), port, stream.num_channel, mtu);
+        is_announced = false;
+    }
+    if (is_announced) {
+        LOGI("Using %s:%d as announced: %u Hz, %u channels instead of %d Hz, %d channels",
+             ip.c_str(), port, stream.sample_rate, stream.num_channel, sample_rate,
+             num_channel);
+        sample_rate = jint(stream.sample_rate);
+        num_channel = jint(stream.num_channel);
+        // The mask was chosen for the configured channels, it may select ones the stream
+        // does not have
+        if (unsigned(mask_channel) >> stream.num_channel) {
+            LOGW("mask_channel 0x%x does not fit %u channels, playing all of them",
+                 unsigned(mask_channel), stream.num_channel);
+            mask_channel = 0;
+        }
+    }
     auto engine = PulseRtpOboeEngine::Create(
-            latency_option, ip, (uint16_t) port, mtu, max_latency, num_channel, mask_channel);
+            latency_option, ip, (uint16_t) port, mtu, max_latency, num_channel, mask_channel,
+            suspend_idle, sync_delay, sample_rate);
     return reinterpret_cast<jlong>(engine.release());
 }
 
@@ -168,4 +197,60 @@ Java_me_wenxinwang_pulsedroidrtp_PulseRtpAudioEngine_native_1getPktReceived(
     return jlong(engine->pkt_recved());
 }
 
+JNIEXPORT jint JNICALL
+Java_me_wenxinwang_pulsedroidrtp_PulseRtpAudioEngine_native_1getSyncError(
+        JNIEnv *env,
+        jclass /*unused*/,
+        jlong engineHandle) {
+    if (!engineHandle) {
+        return 0;
+    }
+    auto engine = reinterpret_cast<PulseRtpOboeEngine *>(engineHandle);
+    return jint(engine->sync_error());
+}
+
+JNIEXPORT jlong JNICALL
+Java_me_wenxinwang_pulsedroidrtp_PulseRtpAudioEngine_native_1createDiscovery(
+        JNIEnv *env,
+        jclass /*unused*/) {
+    auto discovery = std::make_unique<SapDiscovery>();
+    if (!discovery->Start()) {
+        return 0;
+    }
+    return reinterpret_cast<jlong>(discovery.release());
+}
+
+JNIEXPORT void JNICALL
+Java_me_wenxinwang_pulsedroidrtp_PulseRtpAudioEngine_native_1deleteDiscovery(
+        JNIEnv *env,
+        jclass /*unused*/,
+        jlong discoveryHandle) {
+
+    delete reinterpret_cast<SapDiscovery *>(discoveryHandle);
+}
+
+// Each stream as "ip:port rate channels name", the name may contain spaces
+JNIEXPORT jobjectArray JNICALL
+Java_me_wenxinwang_pulsedroidrtp_PulseRtpAudioEngine_native_1getDiscoveredStreams(
+        JNIEnv *env,
+        jclass /*unused*/,
+        jlong discoveryHandle) {
+    std::vector<SdpStream> streams;
+    if (discoveryHandle) {
+        streams = reinterpret_cast<SapDiscovery *>(discoveryHandle)->streams();
+    }
+    jobjectArray result = env->NewObjectArray(
+            jsize(streams.size()), env->FindClass("java/lang/String"), nullptr);
+    for (size_t i = 0; i < streams.size(); ++i) {
+        const auto &stream = streams[i];
+        std::string desc = stream.ip + ":" + std::to_string(stream.port) + " " +
+                           std::to_string(stream.sample_rate) + " " +
+                           std::to_string(stream.num_channel) + " " + stream.name;
+        jstring jdesc = env->NewStringUTF(desc.c_str());
+        env->SetObjectArrayElement(result, jsize(i), jdesc);
+        env->DeleteLocalRef(jdesc);
+    }
+    return result;
+}
+
 } // extern "C"
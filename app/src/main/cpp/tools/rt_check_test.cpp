@@ -0,0 +1,138 @@
+/*
+ * Copyright 2020 Wenxin Wang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Sends packets over loopback to the receive thread and plays them out, with the real-time
+// checks armed after warm-up. Fails if a real-time section allocated, locked or blocked.
+
+#include "AudioPlayout.h"
+#include "RtpReceiver.h"
+#include "RtCheck.h"
+#include "Tracing.h"
+#include <asio.hpp>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace {
+    const unsigned kRate = 48000;
+    const unsigned kNumChannel = 2;
+    const unsigned kMtu = 320;
+    const unsigned kMaxLatency = 300;
+    const unsigned kFramesPerPacket = kMtu / 2 / kNumChannel;
+    const unsigned kRtpHeader = 12;
+    const int64_t kNtpUnixOffset = 2208988800LL;
+    const uint32_t kSsrc = 0x1234;
+    const int64_t kSyncDelayNs = 50000000;
+    const unsigned kNumPackets = 1500;
+    const unsigned kWarmupPackets = 300;
+
+    void WriteBe16(uint8_t *p, uint16_t v) {
+        p[0] = uint8_t(v >> 8U);
+        p[1] = uint8_t(v);
+    }
+
+    void WriteBe32(uint8_t *p, uint32_t v) {
+        WriteBe16(p, uint16_t(v >> 16U));
+        WriteBe16(p + 2, uint16_t(v));
+    }
+
+    int64_t WallNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // rtp_ts is sent now. Only taken once the receiver got a packet of kSsrc.
+    void SendSenderReport(asio::ip::udp::socket &socket, const asio::ip::udp::endpoint &dest,
+                          uint32_t rtp_ts) {
+        int64_t wall_ns = WallNs();
+        uint8_t sr[28] = {};
+        sr[0] = 0x80;
+        sr[1] = 200;
+        WriteBe16(sr + 2, sizeof(sr) / 4 - 1);
+        WriteBe32(sr + 4, kSsrc);
+        WriteBe32(sr + 8, uint32_t(wall_ns / 1000000000LL + kNtpUnixOffset));
+        WriteBe32(sr + 12, uint32_t(((wall_ns % 1000000000LL) << 32U) / 1000000000LL));
+        WriteBe32(sr + 16, rtp_ts);
+        socket.send_to(asio::buffer(sr), dest);
+    }
+
+    bool Run(const char *name, unsigned coalesce_ms, uint16_t port) {
+        RtLog rt_log("rt_check_test");
+        rt_log.Start();
+        PacketBuffer pkt_buffer(kMtu, kRate, kMaxLatency, kNumChannel);
+        RtcpSession rtcp(kRate);
+        RtpReceiveThread receiver(pkt_buffer, rt_log, "127.0.0.1", port, kMtu);
+        if (!receiver.Start(coalesce_ms, 0, []() {}, []() {}, &rtcp, []() {})) {
+            fprintf(stderr, "%s: failed to start receiver\n", name);
+            return false;
+        }
+        AudioPlayout playout(pkt_buffer, rt_log, kNumChannel, 0, &rtcp, kSyncDelayNs);
+        TRACE_REGISTER_THREAD();
+
+        asio::io_context io;
+        asio::ip::udp::socket socket(io, asio::ip::udp::v4());
+        asio::ip::udp::endpoint dest(asio::ip::make_address("127.0.0.1"), port);
+        asio::ip::udp::endpoint rtcp_dest(dest.address(), port + 1);
+        std::vector<uint8_t> pkt(kRtpHeader + kMtu);
+        std::vector<int16_t> output(kFramesPerPacket * kNumChannel);
+        const auto period = std::chrono::microseconds(1000000 * kFramesPerPacket / kRate);
+
+        auto next = std::chrono::steady_clock::now();
+        for (unsigned i = 0; i < kNumPackets; ++i) {
+            if (i == kWarmupPackets) {
+                rt_check::Arm(false);
+            }
+            pkt[0] = 0x80;
+            pkt[1] = 127;
+            WriteBe16(pkt.data() + 2, uint16_t(i));
+            WriteBe32(pkt.data() + 4, i * kFramesPerPacket);
+            WriteBe32(pkt.data() + 8, kSsrc);
+            for (unsigned j = kRtpHeader; j < pkt.size(); j += 2) {
+                WriteBe16(pkt.data() + j, uint16_t(i * 64 + j));
+            }
+            socket.send_to(asio::buffer(pkt), dest);
+            if (i == kWarmupPackets / 2) {
+                SendSenderReport(socket, rtcp_dest, i * kFramesPerPacket);
+            }
+            std::this_thread::sleep_until(next += period);
+            playout.Render(output.data(), int32_t(kFramesPerPacket), kRate, WallNs());
+        }
+        rt_check::Disarm();
+        receiver.Stop();
+        rt_log.Stop();
+
+        if (receiver.pkt_recved() < kWarmupPackets) {
+            fprintf(stderr, "%s: received %u of %u packets\n", name, receiver.pkt_recved(),
+                    kNumPackets);
+            return false;
+        }
+        if (rt_check::violations()) {
+            fprintf(stderr, "%s: %u real-time violations, first: %s\n", name,
+                    rt_check::violations(), rt_check::first_violation());
+            return false;
+        }
+        printf("%s: ok, received %u packets, sync error %d frames\n", name,
+               receiver.pkt_recved(), playout.sync_error());
+        return true;
+    }
+}
+
+int main() {
+    bool ok = Run("per-packet", 0, 47010);
+    ok = Run("coalesce", 5, 47020) && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,674 @@
+/*
+ * Copyright 2020 Wenxin Wang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// RTP load generator, sending s16be like module-rtp-send, with optional network impairments.
+// In soak mode, the receiver and the playout of the engine run in the same process on
+// loopback, with a simulated audio output clock, and statistics are reported periodically.
+// In discover mode, streams announced over SAP are listed.
+
+#include "AudioPlayout.h"
+#include "RtpReceiver.h"
+#include "RtCheck.h"
+#include "SapDiscovery.h"
+#include "Tracing.h"
+#include <asio.hpp>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <csignal>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+    const unsigned kRtpHeader = 12;
+    const unsigned kSampleSize = 2;
+    const uint8_t kRtpPayloadType = 127;
+    const unsigned kRtcpIntervalMs = 5000;
+    const int64_t kNtpUnixOffset = 2208988800LL;
+    const double kRtCheckWarmupS = 2;
+    // Same as PulseAudio module-rtp-send
+    const unsigned kSapIntervalMs = 5000;
+    const char kSdpMimeType[] = "application/sdp";
+
+    using Clock = std::chrono::steady_clock;
+
+    std::atomic<bool> interrupted(false);
+
+    void OnInterrupt(int) {
+        interrupted = true;
+    }
+
+    struct Options {
+        enum class Mode {
+            Send,
+            Soak,
+            Discover,
+        } mode = Mode::Send;
+        std::vector<asio::ip::udp::endpoint> dests;
+        unsigned ssrcs = 1;
+        unsigned rate = 48000;
+        unsigned num_channel = 2;
+        unsigned mtu = 320;
+        double duration_s = 0;
+        double jitter_ms = 0;
+        double loss = 0;
+        double reorder = 0;
+        double duplicate = 0;
+        double skew_ppm = 0;
+        bool silence = false;
+        bool rtcp = false;
+        bool sap = false;
+        asio::ip::udp::endpoint sap_dest{asio::ip::make_address("224.0.0.56"), 9875};
+        // soak only
+        unsigned max_latency = 300;
+        unsigned burst = 192;
+        unsigned coalesce_ms = 0;
+        unsigned sync_delay_ms = 0;
+        double report_s = 10;
+    };
+
+    void Usage(const char *argv0) {
+        fprintf(stderr,
+                "usage: %s send|soak|discover [options]\n"
+                "  --dest ip:port     destination, may be repeated (default 127.0.0.1:4010)\n"
+                "  --ssrcs n          streams per destination (default 1)\n"
+                "  --rate hz          sample rate (default 48000)\n"
+                "  --num-channel n    channels (default 2)\n"
+                "  --mtu bytes        payload bytes per packet (default 320)\n"
+                "  --duration s       stop after s seconds, 0 to run forever (default 0)\n"
+                "  --jitter ms        delay each packet by up to ms, uniformly\n"
+                "  --loss p           drop packets with probability p\n"
+                "  --reorder p        swap a packet with the next one with probability p\n"
+                "  --duplicate p      send packets twice with probability p\n"
+                "  --skew ppm         run the sender clock ppm fast (negative for slow)\n"
+                "  --silence          send silence instead of a 440Hz tone\n"
+                "  --rtcp             send RTCP sender reports to port + 1\n"
+                "  --sap              announce the streams over SAP\n"
+                "  --sap-dest ip:port SAP address to announce on or, in discover mode, listen\n"
+                "                     on (default 224.0.0.56:9875)\n"
+                "soak options, receiving from the first destination:\n"
+                "  --max-latency ms   packet buffer size (default 300)\n"
+                "  --burst frames     frames per simulated audio callback (default 192)\n"
+                "  --coalesce ms      drain the socket every ms instead of per packet\n"
+                "  --sync-delay ms    play in sync with the RTCP sender reports, implies --rtcp\n"
+                "  --report s         report interval, also for discover (default 10)\n",
+                argv0);
+    }
+
+    bool ParseEndpoint(const std::string &s, asio::ip::udp::endpoint *endpoint) {
+        auto colon = s.rfind(':');
+        if (colon == std::string::npos) {
+            return false;
+        }
+        asio::error_code error;
+        auto address = asio::ip::make_address(s.substr(0, colon), error);
+        if (error) {
+            return false;
+        }
+        *endpoint = asio::ip::udp::endpoint(address, uint16_t(atoi(s.c_str() + colon + 1)));
+        return true;
+    }
+
+    bool ParseOptions(int argc, char **argv, Options *opts) {
+        if (argc < 2) {
+            return false;
+        }
+        std::string mode = argv[1];
+        if (mode == "soak") {
+            opts->mode = Options::Mode::Soak;
+        } else if (mode == "discover") {
+            opts->mode = Options::Mode::Discover;
+        } else if (mode != "send") {
+            return false;
+        }
+        for (int i = 2; i < argc; ++i) {
+            std::string key = argv[i];
+            if (key == "--silence") {
+                opts->silence = true;
+                continue;
+            } else if (key == "--rtcp") {
+                opts->rtcp = true;
+                continue;
+            } else if (key == "--sap") {
+                opts->sap = true;
+                continue;
+            }
+            if (i + 1 >= argc) {
+                return false;
+            }
+            const char *value = argv[++i];
+            if (key == "--dest") {
+                asio::ip::udp::endpoint endpoint;
+                if (!ParseEndpoint(value, &endpoint)) {
+                    return false;
+                }
+                opts->dests.push_back(endpoint);
+            } else if (key == "--sap-dest") {
+                if (!ParseEndpoint(value, &opts->sap_dest)) {
+                    return false;
+                }
+            } else if (key == "--ssrcs") {
+                opts->ssrcs = unsigned(atoi(value));
+            } else if (key == "--rate") {
+                opts->rate = unsigned(atoi(value));
+            } else if (key == "--num-channel") {
+                opts->num_channel = unsigned(atoi(value));
+            } else if (key == "--mtu") {
+                opts->mtu = unsigned(atoi(value));
+            } else if (key == "--duration") {
+                opts->duration_s = atof(value);
+            } else if (key == "--jitter") {
+                opts->jitter_ms = atof(value);
+            } else if (key == "--loss") {
+                opts->loss = atof(value);
+            } else if (key == "--reorder") {
+                opts->reorder = atof(value);
+            } else if (key == "--duplicate") {
+                opts->duplicate = atof(value);
+            } else if (key == "--skew") {
+                opts->skew_ppm = atof(value);
+            } else if (key == "--max-latency") {
+                opts->max_latency = unsigned(atoi(value));
+            } else if (key == "--burst") {
+                opts->burst = unsigned(atoi(value));
+            } else if (key == "--coalesce") {
+                opts->coalesce_ms = unsigned(atoi(value));
+            } else if (key == "--sync-delay") {
+                opts->sync_delay_ms = unsigned(atoi(value));
+                opts->rtcp = opts->rtcp || opts->sync_delay_ms;
+            } else if (key == "--report") {
+                opts->report_s = atof(value);
+            } else {
+                return false;
+            }
+        }
+        if (opts->dests.empty()) {
+            opts->dests.emplace_back(asio::ip::make_address("127.0.0.1"), 4010);
+        }
+        unsigned frame_size = opts->num_channel * kSampleSize;
+        return opts->ssrcs && opts->rate && opts->num_channel && opts->mtu >= frame_size &&
+               opts->mtu % frame_size == 0;
+    }
+
+    void WriteBe16(uint8_t *p, uint16_t v) {
+        p[0] = uint8_t(v >> 8U);
+        p[1] = uint8_t(v);
+    }
+
+    void WriteBe32(uint8_t *p, uint32_t v) {
+        p[0] = uint8_t(v >> 24U);
+        p[1] = uint8_t(v >> 16U);
+        p[2] = uint8_t(v >> 8U);
+        p[3] = uint8_t(v);
+    }
+
+    int64_t CpuNs(clockid_t clock_id) {
+        timespec ts{};
+        clock_gettime(clock_id, &ts);
+        return int64_t(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+    }
+
+    struct Stream {
+        asio::ip::udp::endpoint dest;
+        uint32_t ssrc;
+        uint16_t seq;
+        uint32_t rtp_ts;
+        double phase;
+        uint32_t pkt_sent;
+        uint32_t octet_sent;
+    };
+
+    struct Scheduled {
+        Clock::time_point when;
+        uint64_t order;
+        size_t stream;
+        std::vector<uint8_t> data;
+
+        bool operator>(const Scheduled &other) const {
+            return when != other.when ? when > other.when : order > other.order;
+        }
+    };
+
+    class Sender {
+    public:
+        explicit Sender(const Options &opts)
+                : opts_(opts), socket_(io_), rng_(std::random_device()()) {
+            socket_.open(opts.dests[0].protocol());
+            socket_.set_option(asio::ip::multicast::enable_loopback(true));
+            socket_.set_option(asio::ip::multicast::hops(1));
+            for (auto &dest : opts.dests) {
+                for (unsigned i = 0; i < opts.ssrcs; ++i) {
+                    streams_.push_back(Stream{dest, uint32_t(rng_()), uint16_t(rng_()),
+                                              uint32_t(rng_()), 0, 0, 0});
+                }
+            }
+        }
+
+        // Sends until stop is set or the duration is reached
+        void Run(const std::atomic<bool> &stop) {
+            const unsigned frames = opts_.mtu / (opts_.num_channel * kSampleSize);
+            // A fast sender clock sends packets more often
+            const auto period = std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(
+                            double(frames) / opts_.rate / (1 + opts_.skew_ppm * 1e-6)));
+            const auto start = Clock::now();
+            auto next = start;
+            auto next_rtcp = start;
+            auto next_sap = start;
+            std::uniform_real_distribution<double> uniform(0, 1);
+            std::vector<std::vector<uint8_t>> held(streams_.size());
+
+            while (!stop) {
+                auto now = Clock::now();
+                if (opts_.duration_s > 0 &&
+                    now - start >= std::chrono::duration<double>(opts_.duration_s)) {
+                    break;
+                }
+                if (opts_.rtcp && now >= next_rtcp) {
+                    for (auto &stream : streams_) {
+                        SendSenderReport(stream, start, period, frames);
+                    }
+                    next_rtcp += std::chrono::milliseconds(kRtcpIntervalMs);
+                }
+                if (opts_.sap && now >= next_sap) {
+                    for (size_t i = 0; i < opts_.dests.size(); ++i) {
+                        SendAnnouncement(i, false);
+                    }
+                    next_sap += std::chrono::milliseconds(kSapIntervalMs);
+                }
+                if (now >= next) {
+                    for (size_t i = 0; i < streams_.size(); ++i) {
+                        auto pkt = BuildPacket(streams_[i], frames);
+                        if (uniform(rng_) < opts_.loss) {
+                            ++num_lost_;
+                            continue;
+                        }
+                        if (held[i].empty() && uniform(rng_) < opts_.reorder) {
+                            // Send after the next packet of this stream
+                            held[i] = std::move(pkt);
+                            ++num_reordered_;
+                            continue;
+                        }
+                        Schedule(next, i, pkt);
+                        if (uniform(rng_) < opts_.duplicate) {
+                            Schedule(next, i, pkt);
+                            ++num_duplicated_;
+                        }
+                        if (!held[i].empty()) {
+                            Schedule(next, i, held[i]);
+                            held[i].clear();
+                        }
+                    }
+                    next += period;
+                }
+                while (!queue_.empty() && queue_.top().when <= now) {
+                    auto &top = queue_.top();
+                    asio::error_code error;
+                    socket_.send_to(asio::buffer(top.data), streams_[top.stream].dest, 0, error);
+                    if (error) {
+                        ++num_send_error_;
+                    } else {
+                        ++num_sent_;
+                    }
+                    queue_.pop();
+                }
+                auto wake = next;
+                if (!queue_.empty()) {
+                    wake = std::min(wake, queue_.top().when);
+                }
+                std::this_thread::sleep_until(wake);
+            }
+            if (opts_.sap) {
+                for (size_t i = 0; i < opts_.dests.size(); ++i) {
+                    SendAnnouncement(i, true);
+                }
+            }
+        }
+
+        uint64_t num_sent() const { return num_sent_; }
+
+        uint64_t num_lost() const { return num_lost_; }
+
+        uint64_t num_reordered() const { return num_reordered_; }
+
+        uint64_t num_duplicated() const { return num_duplicated_; }
+
+        uint64_t num_send_error() const { return num_send_error_; }
+
+    private:
+        std::vector<uint8_t> BuildPacket(Stream &stream, unsigned frames) {
+            std::vector<uint8_t> pkt(kRtpHeader + opts_.mtu);
+            pkt[0] = 0x80; // V=2
+            pkt[1] = kRtpPayloadType;
+            WriteBe16(&pkt[2], stream.seq++);
+            WriteBe32(&pkt[4], stream.rtp_ts);
+            WriteBe32(&pkt[8], stream.ssrc);
+            stream.rtp_ts += frames;
+            uint8_t *payload = &pkt[kRtpHeader];
+            for (unsigned i = 0; i < frames; ++i) {
+                int16_t sample = 0;
+                if (!opts_.silence) {
+                    sample = int16_t(8192 * std::sin(stream.phase));
+                    stream.phase += 2 * M_PI * 440 / opts_.rate;
+                    if (stream.phase > 2 * M_PI) {
+                        stream.phase -= 2 * M_PI;
+                    }
+                }
+                for (unsigned j = 0; j < opts_.num_channel; ++j) {
+                    WriteBe16(payload, uint16_t(sample));
+                    payload += kSampleSize;
+                }
+            }
+            ++stream.pkt_sent;
+            stream.octet_sent += opts_.mtu;
+            return pkt;
+        }
+
+        void Schedule(Clock::time_point when, size_t stream, const std::vector<uint8_t> &pkt) {
+            if (opts_.jitter_ms > 0) {
+                std::uniform_real_distribution<double> jitter(0, opts_.jitter_ms);
+                when += std::chrono::duration_cast<Clock::duration>(
+                        std::chrono::duration<double, std::milli>(jitter(rng_)));
+            }
+            queue_.push(Scheduled{when, order_++, stream, pkt});
+        }
+
+        void SendSenderReport(Stream &stream, Clock::time_point start, Clock::duration period,
+                              unsigned frames) {
+            auto wall = std::chrono::system_clock::now().time_since_epoch();
+            auto wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(wall).count();
+            // RTP timestamp being sent right now, on the (possibly skewed) sender clock
+            double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+            double pkts = elapsed / std::chrono::duration<double>(period).count();
+            uint32_t rtp_ts = stream.rtp_ts - stream.pkt_sent * frames + uint32_t(pkts * frames);
+
+            uint8_t sr[28];
+            sr[0] = 0x80;
+            sr[1] = 200;
+            WriteBe16(sr + 2, sizeof(sr) / 4 - 1);
+            WriteBe32(sr + 4, stream.ssrc);
+            WriteBe32(sr + 8, uint32_t(wall_ns / 1000000000LL + kNtpUnixOffset));
+            WriteBe32(sr + 12, uint32_t(((wall_ns % 1000000000LL) << 32U) / 1000000000LL));
+            WriteBe32(sr + 16, rtp_ts);
+            WriteBe32(sr + 20, stream.pkt_sent);
+            WriteBe32(sr + 24, stream.octet_sent);
+            asio::ip::udp::endpoint dest(stream.dest.address(), stream.dest.port() + 1);
+            asio::error_code error;
+            socket_.send_to(asio::buffer(sr), dest, 0, error);
+        }
+
+        // One announcement per destination, all SSRCs of it are the same stream to a receiver
+        void SendAnnouncement(size_t index, bool is_deletion) {
+            const auto &dest = opts_.dests[index];
+            const char *addr_type = dest.address().is_v6() ? "IP6" : "IP4";
+            std::string sdp =
+                    "v=0\r\n"
+                    "o=rtp-load " + std::to_string(sap_id_ + index) + " 0 IN IP4 127.0.0.1\r\n"
+                    "s=rtp-load " + dest.address().to_string() + ":" +
+                    std::to_string(dest.port()) + "\r\n"
+                    "c=IN " + addr_type + " " + dest.address().to_string() + "\r\n"
+                    "t=0 0\r\n"
+                    "a=recvonly\r\n"
+                    "m=audio " + std::to_string(dest.port()) + " RTP/AVP " +
+                    std::to_string(kRtpPayloadType) + "\r\n"
+                    "a=rtpmap:" + std::to_string(kRtpPayloadType) + " L16/" +
+                    std::to_string(opts_.rate) + "/" + std::to_string(opts_.num_channel) +
+                    "\r\n"
+                    "a=type:broadcast\r\n";
+            // V=1, IPv4 origin 127.0.0.1, no authentication
+            std::vector<uint8_t> pkt{uint8_t(is_deletion ? 0x24 : 0x20), 0, 0, 0, 127, 0, 0, 1};
+            WriteBe16(&pkt[2], uint16_t(sap_id_ + index));
+            pkt.insert(pkt.end(), kSdpMimeType, kSdpMimeType + sizeof(kSdpMimeType));
+            pkt.insert(pkt.end(), sdp.begin(), sdp.end());
+            asio::error_code error;
+            socket_.send_to(asio::buffer(pkt), opts_.sap_dest, 0, error);
+            if (error) {
+                fprintf(stderr, "Failed to send SAP announcement, %s\n", error.message().c_str());
+            }
+        }
+
+        const Options &opts_;
+        asio::io_context io_;
+        asio::ip::udp::socket socket_;
+        std::mt19937 rng_;
+        const uint32_t sap_id_ = uint32_t(rng_());
+        std::vector<Stream> streams_;
+        std::priority_queue<Scheduled, std::vector<Scheduled>, std::greater<Scheduled>> queue_;
+        uint64_t order_ = 0;
+        std::atomic<uint64_t> num_sent_{0};
+        std::atomic<uint64_t> num_lost_{0};
+        std::atomic<uint64_t> num_reordered_{0};
+        std::atomic<uint64_t> num_duplicated_{0};
+        std::atomic<uint64_t> num_send_error_{0};
+    };
+
+    // Runs the engine's playout against a simulated audio output clock, which plays one burst
+    // after it is rendered
+    class Playout {
+    public:
+        Playout(PacketBuffer &pkt_buffer, RtLog &rt_log, const RtcpSession *rtcp,
+                const Options &opts)
+                : pkt_buffer_(pkt_buffer), opts_(opts),
+                  playout_(pkt_buffer, rt_log, opts.num_channel, 0, rtcp,
+                           int64_t(opts.sync_delay_ms) * 1000000),
+                  output_(opts.burst * opts.num_channel) {}
+
+        void Run(const std::atomic<bool> &stop) {
+            TRACE_REGISTER_THREAD();
+            const auto period = std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(double(opts_.burst) / opts_.rate));
+            // Let the buffer fill up to where the engine leaves Depleted
+            while (!stop && pkt_buffer_.size() < pkt_buffer_.capacity() / 8) {
+                std::this_thread::sleep_for(period);
+            }
+            auto next = Clock::now();
+            while (!stop) {
+                std::this_thread::sleep_until(next);
+                next += period;
+                TRACE_SCOPE("Playout");
+                auto begin = Clock::now();
+                auto present = std::chrono::system_clock::now() + period;
+                int64_t present_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        present.time_since_epoch()).count();
+                int32_t num_missing = playout_.Render(output_.data(), int32_t(opts_.burst),
+                                                      opts_.rate, present_ns);
+                ++num_callback_;
+                if (num_missing) {
+                    ++num_glitch_;
+                }
+                auto duration_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        Clock::now() - begin).count();
+                max_callback_ns_ = std::max<int64_t>(max_callback_ns_, duration_ns);
+            }
+        }
+
+        uint64_t num_callback() const { return num_callback_; }
+
+        uint64_t num_glitch() const { return num_glitch_; }
+
+        int64_t max_callback_ns() const { return max_callback_ns_; }
+
+        int sync_error() const { return playout_.sync_error(); }
+
+    private:
+        PacketBuffer &pkt_buffer_;
+        const Options &opts_;
+        AudioPlayout playout_;
+        std::vector<int16_t> output_;
+        std::atomic<uint64_t> num_callback_{0};
+        std::atomic<uint64_t> num_glitch_{0};
+        std::atomic<int64_t> max_callback_ns_{0};
+    };
+
+    long MaxRssKb() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    int Send(const Options &opts) {
+        Sender sender(opts);
+        sender.Run(interrupted);
+        printf("sent %llu lost %llu reordered %llu duplicated %llu errors %llu\n",
+               (unsigned long long) sender.num_sent(), (unsigned long long) sender.num_lost(),
+               (unsigned long long) sender.num_reordered(),
+               (unsigned long long) sender.num_duplicated(),
+               (unsigned long long) sender.num_send_error());
+        return 0;
+    }
+
+    int Discover(const Options &opts) {
+        SapDiscovery discovery(opts.sap_dest.address().to_string(), opts.sap_dest.port());
+        if (!discovery.Start()) {
+            fprintf(stderr, "Failed to start discovery\n");
+            return 1;
+        }
+        const auto start = Clock::now();
+        auto next = start;
+        while (!interrupted) {
+            auto now = Clock::now();
+            if (opts.duration_s > 0 &&
+                now - start >= std::chrono::duration<double>(opts.duration_s)) {
+                break;
+            }
+            if (now >= next) {
+                auto streams = discovery.streams();
+                printf("%zu stream(s)\n", streams.size());
+                for (const auto &stream : streams) {
+                    printf("  %s:%u %uHz %u channels  %s\n", stream.ip.c_str(), stream.port,
+                           stream.sample_rate, stream.num_channel, stream.name.c_str());
+                }
+                fflush(stdout);
+                next += std::chrono::duration_cast<Clock::duration>(
+                        std::chrono::duration<double>(opts.report_s));
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        discovery.Stop();
+        return 0;
+    }
+
+    int Soak(const Options &opts) {
+        const auto &dest = opts.dests[0];
+        RtLog rt_log("rtp-load");
+        rt_log.Start();
+        PacketBuffer pkt_buffer(opts.mtu, opts.rate, opts.max_latency, opts.num_channel);
+        RtcpSession rtcp(opts.rate);
+        RtpReceiveThread receiver(pkt_buffer, rt_log, dest.address().to_string(), dest.port(),
+                                  opts.mtu);
+        if (!receiver.Start(opts.coalesce_ms, 0, []() {}, []() {},
+                            opts.rtcp ? &rtcp : nullptr, []() {})) {
+            fprintf(stderr, "Failed to start receiver\n");
+            return 1;
+        }
+        // Only the receive thread, so the sender and playout threads don't count
+        clockid_t receiver_clock_id{};
+        if (pthread_getcpuclockid(receiver.native_handle(), &receiver_clock_id)) {
+            fprintf(stderr, "Failed to get the CPU clock of the receiver\n");
+            receiver.Stop();
+            return 1;
+        }
+
+        std::atomic<bool> stop(false);
+        Sender sender(opts);
+        Playout playout(pkt_buffer, rt_log, opts.sync_delay_ms ? &rtcp : nullptr, opts);
+        std::thread sender_thread([&]() {
+            sender.Run(stop);
+            stop = true;
+        });
+        std::thread playout_thread([&]() { playout.Run(stop); });
+
+        printf("%8s %10s %10s %8s %8s %10s %10s %9s %9s %8s\n",
+               "time_s", "sent", "received", "dropped", "glitch", "glitch/min",
+               "cpu_us/pkt", "max_cb_us", "rss_kb", "sync_us");
+        const auto start = Clock::now();
+        auto last = start;
+        int64_t last_cpu_ns = CpuNs(receiver_clock_id);
+        unsigned last_recved = 0;
+        while (!stop) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            if (interrupted) {
+                stop = true;
+            }
+            auto now = Clock::now();
+            if (now - last < std::chrono::duration<double>(opts.report_s) && !stop) {
+                continue;
+            }
+            int64_t cpu_ns = CpuNs(receiver_clock_id);
+            unsigned recved = receiver.pkt_recved();
+            double elapsed = std::chrono::duration<double>(now - start).count();
+#ifdef PULSERTP_RT_CHECK
+            if (elapsed >= kRtCheckWarmupS) {
+                rt_check::Arm(true);
+            }
+#endif
+            double cpu_per_pkt = recved != last_recved ?
+                                 double(cpu_ns - last_cpu_ns) / 1000 / (recved - last_recved) : 0;
+            printf("%8.0f %10llu %10u %8u %8llu %10.2f %10.2f %9.1f %9ld %8lld\n",
+                   elapsed, (unsigned long long) sender.num_sent(), recved,
+                   pkt_buffer.tail_move_req() - pkt_buffer.tail_move(),
+                   (unsigned long long) playout.num_glitch(),
+                   elapsed > 0 ? playout.num_glitch() * 60 / elapsed : 0, cpu_per_pkt,
+                   double(playout.max_callback_ns()) / 1000, MaxRssKb(),
+                   (long long) playout.sync_error() * 1000000 / opts.rate);
+            fflush(stdout);
+            last = now;
+            last_cpu_ns = cpu_ns;
+            last_recved = recved;
+        }
+        stop = true;
+        sender_thread.join();
+        playout_thread.join();
+        receiver.Stop();
+        rt_log.Stop();
+        TRACE_DUMP();
+        printf("callbacks %llu glitches %llu, lost %llu reordered %llu duplicated %llu\n",
+               (unsigned long long) playout.num_callback(),
+               (unsigned long long) playout.num_glitch(),
+               (unsigned long long) sender.num_lost(),
+               (unsigned long long) sender.num_reordered(),
+               (unsigned long long) sender.num_duplicated());
+        return 0;
+    }
+}
+
+int main(int argc, char **argv) {
+    Options opts;
+    if (!ParseOptions(argc, argv, &opts)) {
+        Usage(argv[0]);
+        return 2;
+    }
+    signal(SIGINT, OnInterrupt);
+    signal(SIGTERM, OnInterrupt);
+    switch (opts.mode) {
+        case Options::Mode::Soak:
+            return Soak(opts);
+        case Options::Mode::Discover:
+            return Discover(opts);
+        default:
+            return Send(opts);
+    }
+}
@@ -0,0 +1,208 @@
+/*
+ * Copyright 2020 Wenxin Wang
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// RTCP sync of the playout: a synthetic sender report and packets pushed straight into the
+// packet buffer, played out against a made-up output clock.
+
+#include "AudioPlayout.h"
+#include "RtpReceiver.h"
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+    const unsigned kRate = 48000;
+    const unsigned kNumChannel = 2;
+    const unsigned kMtu = 320;
+    const unsigned kMaxLatency = 300;
+    const unsigned kFramesPerPacket = kMtu / 2 / kNumChannel;
+    const unsigned kBurst = 192;
+    const int64_t kNtpUnixOffset = 2208988800LL;
+    const uint32_t kSsrc = 0x1234;
+    // Whole seconds, so the mapping has no rounding
+    const int64_t kSrWallS = 1600000000;
+    const int64_t kSyncDelayNs = 50000000;
+    // Same as the playout: 250us tolerance, 20ms max slew
+    const int32_t kToleranceFrames = 12;
+    const int32_t kMaxSlewFrames = 960;
+
+    bool failed = false;
+
+    void Expect(bool ok, const char *what) {
+        if (!ok) {
+            fprintf(stderr, "FAILED: %s\n", what);
+            failed = true;
+        }
+    }
+
+    void WriteBe32(uint8_t *p, uint32_t v) {
+        p[0] = uint8_t(v >> 24U);
+        p[1] = uint8_t(v >> 16U);
+        p[2] = uint8_t(v >> 8U);
+        p[3] = uint8_t(v);
+    }
+
+    // RTP timestamp 0 was sent at kSrWallS. Returns whether the report was taken.
+    bool SendSenderReport(RtcpSession *rtcp, uint32_t ssrc = kSsrc) {
+        uint8_t header[12] = {0x80, 127};
+        WriteBe32(header + 8, kSsrc);
+        rtcp->OnRtp(header, 0);
+        uint8_t sr[28] = {};
+        sr[0] = 0x80;
+        sr[1] = 200;
+        sr[3] = sizeof(sr) / 4 - 1;
+        WriteBe32(sr + 4, ssrc);
+        WriteBe32(sr + 8, uint32_t(kSrWallS + kNtpUnixOffset));
+        return rtcp->OnRtcp(sr, sizeof(sr), 0);
+    }
+
+    // Every sample of a frame is its RTP timestamp + 1, so silence can be told apart
+    bool PushPacket(PacketBuffer *pkt_buffer, uint32_t rtp_ts) {
+        auto vec = pkt_buffer->RefTailForWrite();
+        vec->resize(kFramesPerPacket * kNumChannel);
+        for (unsigned i = 0; i < vec->size(); ++i) {
+            (*vec)[i] = int16_t(htons(uint16_t(rtp_ts + i / kNumChannel + 1)));
+        }
+        pkt_buffer->SetTailTimestamp(rtp_ts);
+        return pkt_buffer->NextTail();
+    }
+
+    // When the output should play frame, i.e. RTP timestamp, frame
+    int64_t PresentNs(int64_t frame) {
+        // Rounded away from zero, so the playout truncates it back to frame exactly
+        int64_t round = frame >= 0 ? kRate - 1 : -int64_t(kRate - 1);
+        int64_t offset_ns = (frame * 1000000000LL + round) / kRate;
+        return kSrWallS * 1000000000LL + kSyncDelayNs + offset_ns;
+    }
+
+    // The playout's position comes from the timestamp of the packet being read
+    void TestPacketBufferOrder() {
+        PacketBuffer pkt_buffer(kMtu, kRate, kMaxLatency, kNumChannel);
+        Expect(!pkt_buffer.RefNextHeadForRead(), "order: empty at first");
+        PushPacket(&pkt_buffer, 0);
+        auto pkt = pkt_buffer.RefNextHeadForRead();
+        Expect(pkt && ntohs(uint16_t((*pkt)[0])) == 1, "order: reads the packet pushed");
+        Expect(pkt_buffer.head_timestamp() == 0, "order: with its timestamp");
+        Expect(!pkt_buffer.RefNextHeadForRead(), "order: empty after reading it");
+        // Around the end of the ring, and up to full
+        for (unsigned i = 1; i < 2 * pkt_buffer.capacity(); ++i) {
+            PushPacket(&pkt_buffer, i * kFramesPerPacket);
+            pkt = pkt_buffer.RefNextHeadForRead();
+            if (!pkt || pkt_buffer.head_timestamp() != i * kFramesPerPacket ||
+                pkt_buffer.RefNextHeadForRead()) {
+                Expect(false, "order: reads each packet once, in order");
+                break;
+            }
+        }
+        // Full before the writer gets to the slot being read
+        while (PushPacket(&pkt_buffer, 0)) {
+        }
+        Expect(pkt_buffer.RefTailForWrite() != pkt, "order: never writes the slot being read");
+    }
+
+    // Another sender's clock must not move the playout
+    void TestOtherSenderIgnored() {
+        RtcpSession rtcp(kRate);
+        RtpClockMapping mapping{};
+        Expect(!SendSenderReport(&rtcp, kSsrc + 1), "other sender: report ignored");
+        Expect(!rtcp.GetMapping(&mapping), "other sender: no mapping");
+        Expect(SendSenderReport(&rtcp), "other sender: own report taken");
+    }
+
+    void TestLateJumps() {
+        RtLog rt_log("sync_test");
+        PacketBuffer pkt_buffer(kMtu, kRate, kMaxLatency, kNumChannel);
+        RtcpSession rtcp(kRate);
+        SendSenderReport(&rtcp);
+        for (unsigned i = 0; i < 100; ++i) {
+            PushPacket(&pkt_buffer, i * kFramesPerPacket);
+        }
+        AudioPlayout playout(pkt_buffer, rt_log, kNumChannel, 0, &rtcp, kSyncDelayNs);
+        std::vector<int16_t> output(kBurst * kNumChannel);
+        const int64_t target = 4000;
+        playout.Render(output.data(), kBurst, kRate, PresentNs(target));
+        Expect(playout.sync_error() < -kMaxSlewFrames, "late: error beyond max slew");
+        Expect(output[0] == target + 1 && output[1] == target + 1, "late: jumps to target");
+        Expect(output[(kBurst - 1) * kNumChannel] == target + kBurst, "late: plays on");
+    }
+
+    void TestEarlyWaits() {
+        RtLog rt_log("sync_test");
+        PacketBuffer pkt_buffer(kMtu, kRate, kMaxLatency, kNumChannel);
+        RtcpSession rtcp(kRate);
+        SendSenderReport(&rtcp);
+        for (unsigned i = 0; i < 100; ++i) {
+            PushPacket(&pkt_buffer, i * kFramesPerPacket);
+        }
+        AudioPlayout playout(pkt_buffer, rt_log, kNumChannel, 0, &rtcp, kSyncDelayNs);
+        std::vector<int16_t> output(kBurst * kNumChannel);
+        int64_t frame = -3000;
+        playout.Render(output.data(), kBurst, kRate, PresentNs(frame));
+        Expect(playout.sync_error() > kMaxSlewFrames, "early: error beyond max slew");
+        bool is_silent = true;
+        for (auto sample : output) {
+            is_silent = is_silent && sample == 0;
+        }
+        Expect(is_silent, "early: plays silence");
+        // Audio starts once the output clock is within max slew, and slews from there
+        while (playout.sync_error() > kMaxSlewFrames) {
+            frame += kBurst;
+            playout.Render(output.data(), kBurst, kRate, PresentNs(frame));
+        }
+        Expect(output[kBurst * kNumChannel - 1] != 0, "early: starts playing");
+    }
+
+    // Within max slew, the playout skips or repeats a frame per callback until in tolerance
+    void TestConverges(int32_t initial_error) {
+        RtLog rt_log("sync_test");
+        PacketBuffer pkt_buffer(kMtu, kRate, kMaxLatency, kNumChannel);
+        RtcpSession rtcp(kRate);
+        SendSenderReport(&rtcp);
+        AudioPlayout playout(pkt_buffer, rt_log, kNumChannel, 0, &rtcp, kSyncDelayNs);
+        std::vector<int16_t> output(kBurst * kNumChannel);
+        uint32_t rtp_ts = 0;
+        int64_t frame = -initial_error;
+        int32_t first_error = 0;
+        for (unsigned i = 0; i < 2 * unsigned(std::abs(initial_error)); ++i) {
+            while (pkt_buffer.size() < pkt_buffer.capacity() / 2) {
+                PushPacket(&pkt_buffer, rtp_ts);
+                rtp_ts += kFramesPerPacket;
+            }
+            playout.Render(output.data(), kBurst, kRate, PresentNs(frame));
+            frame += kBurst;
+            if (!i) {
+                first_error = playout.sync_error();
+            }
+        }
+        Expect(first_error == initial_error, "converge: starts with the initial error");
+        Expect(std::abs(playout.sync_error()) <= kToleranceFrames, "converge: within tolerance");
+    }
+}
+
+int main() {
+    TestPacketBufferOrder();
+    TestOtherSenderIgnored();
+    TestLateJumps();
+    TestEarlyWaits();
+    TestConverges(300);
+    TestConverges(-300);
+    if (failed) {
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
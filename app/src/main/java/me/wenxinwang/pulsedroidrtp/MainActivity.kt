@@ -34,6 +34,7 @@ import android.widget.*
 import android.widget.AdapterView.OnItemSelectedListener
 import androidx.appcompat.app.AppCompatActivity
 import me.wenxinwang.pulsedroidrtp.PulseRtpAudioEngine.audioBufferSize
+import me.wenxinwang.pulsedroidrtp.PulseRtpAudioEngine.discoveredStreams
 import me.wenxinwang.pulsedroidrtp.PulseRtpAudioEngine.framesPerBurstStr
 import me.wenxinwang.pulsedroidrtp.PulseRtpAudioEngine.numUnderrun
 import me.wenxinwang.pulsedroidrtp.PulseRtpAudioEngine.pktBufferCapacity
@@ -44,6 +45,7 @@ import me.wenxinwang.pulsedroidrtp.PulseRtpAudioEngine.pktBufferTailMove
 import me.wenxinwang.pulsedroidrtp.PulseRtpAudioEngine.pktBufferTailMoveReq
 import me.wenxinwang.pulsedroidrtp.PulseRtpAudioEngine.pktReceived
 import me.wenxinwang.pulsedroidrtp.PulseRtpAudioEngine.sampleRateStr
+import me.wenxinwang.pulsedroidrtp.PulseRtpAudioEngine.syncError
 import java.util.*
 
 
@@ -57,6 +59,9 @@ class MainActivity : AppCompatActivity() {
     private lateinit var mNumChannelEdit: EditText
     private lateinit var mMaskChannelEdit: EditText
     private lateinit var mLatencySpinner: Spinner
+    private lateinit var mStreamSpinner: Spinner
+    private lateinit var mStreamAdapter: ArrayAdapter<String>
+    private var mStreams: List<PulseRtpAudioEngine.DiscoveredStream> = emptyList()
 
     private val mParams = PulseRtpAudioEngine.Params()
     private var mPlaying = false
@@ -64,6 +69,7 @@ class MainActivity : AppCompatActivity() {
     private lateinit var mMediaBrowser: MediaBrowserCompat
     private lateinit var mHandler: Handler
     private lateinit var mStatusChecker: Runnable
+    private lateinit var mDiscoveryChecker: Runnable
 
     private val mMediaBrowserConnectionCallback: MediaBrowserCompat.ConnectionCallback =
         object : MediaBrowserCompat.ConnectionCallback() {
@@ -143,6 +149,10 @@ class MainActivity : AppCompatActivity() {
             updateStatus()
             mHandler.postDelayed(mStatusChecker, STATUS_CHECK_INTERVAL.toLong())
         }
+        mDiscoveryChecker = Runnable {
+            updateStreams()
+            mHandler.postDelayed(mDiscoveryChecker, DISCOVERY_CHECK_INTERVAL.toLong())
+        }
         setInfoMsg("""sampleRate: $sampleRateStr, framesPerBurst: $framesPerBurstStr""")
         // Create MediaBrowserServiceCompat
         mMediaBrowser = MediaBrowserCompat(
@@ -174,11 +184,13 @@ class MainActivity : AppCompatActivity() {
     override fun onResume() {
         super.onResume()
         volumeControlStream = AudioManager.STREAM_MUSIC
+        mDiscoveryChecker.run()
         // StartPlaying();
     }
 
     override fun onPause() {
         // StopPlaying();
+        mHandler.removeCallbacks(mDiscoveryChecker)
         super.onPause()
     }
 
@@ -213,6 +225,9 @@ class MainActivity : AppCompatActivity() {
             setInfoMsg("Could not get channel num")
             return false
         }
+        // Only keep the announced rate if the stream wasn't edited by hand since
+        mParams.sampleRate = selectedStream()
+            ?.takeIf { it.ip == mParams.ip && it.port == mParams.port }?.sampleRate ?: 0
         mParams.saveToSharedPref(this)
         PulseRtpAudioService.startServiceWithIntent(this, mParams.toUri(), false)
         return true
@@ -236,7 +251,8 @@ class MainActivity : AppCompatActivity() {
 audioBuffer: $audioBufferSize, underRun: $numUnderrun
 pktBuffer: $pktBufferSize/$pktBufferCapacity $pktReceived
 r: $pktBufferHeadMoveReq/$pktBufferHeadMove
-w: $pktBufferTailMoveReq/$pktBufferTailMove""" else ""
+w: $pktBufferTailMoveReq/$pktBufferTailMove
+sync: $syncError""" else ""
         setInfoMsg(infoMsg)
     }
 
@@ -254,7 +270,53 @@ w: $pktBufferTailMoveReq/$pktBufferTailMove""" else ""
         mNumChannelEdit = findViewById(R.id.numChannelEdit)
         mMaskChannelEdit = findViewById(R.id.maskChannelEdit)
         mLatencySpinner = findViewById(R.id.latencyOptionSpinner)
+        mStreamSpinner = findViewById(R.id.streamSpinner)
         setupLatencySpinner()
+        setupStreamSpinner()
+    }
+
+    private fun setupStreamSpinner() {
+        mStreamAdapter = ArrayAdapter(
+            this,
+            android.R.layout.simple_spinner_item,
+            mutableListOf(getString(R.string.manual_stream))
+        )
+        mStreamAdapter.setDropDownViewResource(android.R.layout.simple_spinner_dropdown_item)
+        mStreamSpinner.adapter = mStreamAdapter
+        mStreamSpinner.onItemSelectedListener = object : OnItemSelectedListener {
+            override fun onItemSelected(adapterView: AdapterView<*>?, view: View?, i: Int, l: Long) {
+                val stream = selectedStream() ?: return
+                mIpEdit.setText(stream.ip)
+                mPortEdit.setText(stream.port.toString())
+                mNumChannelEdit.setText(stream.numChannel.toString())
+            }
+
+            override fun onNothingSelected(adapterView: AdapterView<*>?) {}
+        }
+    }
+
+    private fun selectedStream(): PulseRtpAudioEngine.DiscoveredStream? {
+        return mStreams.getOrNull(mStreamSpinner.selectedItemPosition - 1)
+    }
+
+    private fun updateStreams() {
+        // The service stops discovery when it is destroyed
+        PulseRtpAudioEngine.startDiscovery()
+        val streams = discoveredStreams
+        val descs = streams.map { it.toString() }
+        if (descs == mStreams.map { it.toString() }) {
+            return
+        }
+        val selected = selectedStream()?.toString()
+        mStreams = streams
+        mStreamAdapter.clear()
+        mStreamAdapter.add(getString(R.string.manual_stream))
+        mStreamAdapter.addAll(descs)
+        // Stay on the selected stream, or pick the one being edited once it's announced
+        val index = if (selected != null) descs.indexOf(selected) else streams.indexOfFirst {
+            it.ip == mIpEdit.text.toString() && it.port == mPortEdit.text.toString().toIntOrNull()
+        }
+        mStreamSpinner.setSelection(index + 1)
     }
 
     private fun setupLatencySpinner() {
@@ -314,5 +376,6 @@ w: $pktBufferTailMoveReq/$pktBufferTailMove""" else ""
 
     companion object {
         private const val STATUS_CHECK_INTERVAL = 1000
+        private const val DISCOVERY_CHECK_INTERVAL = 2000
     }
 }
\ No newline at end of file
@@ -52,6 +52,21 @@ object PulseRtpAudioEngine {
                 if (value > 0) field = value
             }
         var maskChannel = 0
+        // Suspend audio output after this many ms without audible packets, 0 to never suspend
+        var suspendIdle = 0
+            set(value) {
+                if (value >= 0) field = value
+            }
+        // Play RTP timestamps this many ms after the sender's RTCP wall clock, 0 to disable
+        var syncDelay = 0
+            set(value) {
+                if (value >= 0) field = value
+            }
+        // Sample rate of the stream, 0 for the device's. Announced streams use their own.
+        var sampleRate = 0
+            set(value) {
+                if (value >= 0) field = value
+            }
 
         fun fromSharedPref(context: Context) {
             val sharedPref = getSharedPreference(context)
@@ -62,6 +77,9 @@ object PulseRtpAudioEngine {
             maxLatency = sharedPref.getInt(SHARED_PREF_MAX_LATENCY, 0)
             numChannel = sharedPref.getInt(SHARED_PREF_NUM_CHANNEL, 0)
             maskChannel = sharedPref.getInt(SHARED_PREF_MASK_CHANNEL, 0)
+            suspendIdle = sharedPref.getInt(SHARED_PREF_SUSPEND_IDLE, 0)
+            syncDelay = sharedPref.getInt(SHARED_PREF_SYNC_DELAY, 0)
+            sampleRate = sharedPref.getInt(SHARED_PREF_SAMPLE_RATE, 0)
         }
 
         fun saveToSharedPref(context: Context) {
@@ -74,6 +92,9 @@ object PulseRtpAudioEngine {
             editor.putInt(SHARED_PREF_MAX_LATENCY, maxLatency)
             editor.putInt(SHARED_PREF_NUM_CHANNEL, numChannel)
             editor.putInt(SHARED_PREF_MASK_CHANNEL, maskChannel)
+            editor.putInt(SHARED_PREF_SUSPEND_IDLE, suspendIdle)
+            editor.putInt(SHARED_PREF_SYNC_DELAY, syncDelay)
+            editor.putInt(SHARED_PREF_SAMPLE_RATE, sampleRate)
             editor.apply()
         }
 
@@ -85,6 +106,9 @@ object PulseRtpAudioEngine {
             maxLatency = uri.getQueryParameter(SHARED_PREF_MAX_LATENCY)?.toIntOrNull() ?: 0
             numChannel = uri.getQueryParameter(SHARED_PREF_NUM_CHANNEL)?.toIntOrNull() ?: 0
             maskChannel = uri.getQueryParameter(SHARED_PREF_MASK_CHANNEL)?.toIntOrNull() ?: 0
+            suspendIdle = uri.getQueryParameter(SHARED_PREF_SUSPEND_IDLE)?.toIntOrNull() ?: 0
+            syncDelay = uri.getQueryParameter(SHARED_PREF_SYNC_DELAY)?.toIntOrNull() ?: 0
+            sampleRate = uri.getQueryParameter(SHARED_PREF_SAMPLE_RATE)?.toIntOrNull() ?: 0
         }
 
         fun toUri(): Uri {
@@ -97,24 +121,77 @@ object PulseRtpAudioEngine {
                 .appendQueryParameter(SHARED_PREF_MAX_LATENCY, maxLatency.toString())
                 .appendQueryParameter(SHARED_PREF_NUM_CHANNEL, numChannel.toString())
                 .appendQueryParameter(SHARED_PREF_MASK_CHANNEL, maskChannel.toString())
+                .appendQueryParameter(SHARED_PREF_SUSPEND_IDLE, suspendIdle.toString())
+                .appendQueryParameter(SHARED_PREF_SYNC_DELAY, syncDelay.toString())
+                .appendQueryParameter(SHARED_PREF_SAMPLE_RATE, sampleRate.toString())
             return builder.build()
         }
     }
 
+    // A stream announced over SAP, e.g. by PulseAudio module-rtp-send
+    class DiscoveredStream(
+        val ip: String,
+        val port: Int,
+        val sampleRate: Int,
+        val numChannel: Int,
+        val name: String
+    ) {
+        override fun toString(): String {
+            return "$name ($ip:$port, ${sampleRate}Hz, ${numChannel}ch)"
+        }
+
+        companion object {
+            // Parses "ip:port rate channels name" from native_getDiscoveredStreams
+            fun parse(desc: String): DiscoveredStream? {
+                val fields = desc.split(" ", limit = 4)
+                if (fields.size < 4) {
+                    return null
+                }
+                val colon = fields[0].lastIndexOf(':')
+                if (colon < 0) {
+                    return null
+                }
+                return DiscoveredStream(
+                    fields[0].substring(0, colon),
+                    fields[0].substring(colon + 1).toIntOrNull() ?: return null,
+                    fields[1].toIntOrNull() ?: return null,
+                    fields[2].toIntOrNull() ?: return null,
+                    fields[3])
+            }
+        }
+    }
+
     private var mEngineHandle: Long = 0
+    private var mDiscoveryHandle: Long = 0
     private var mSampleRateStr: String = ""
     private var mFramesPerBurstStr: String = ""
 
     fun create(params: Params): Boolean {
         if (mEngineHandle == 0L) with(params) {
             mEngineHandle =
-                native_createEngine(latencyOption, ip, port, mtu, maxLatency, numChannel, maskChannel)
+                native_createEngine(
+                    latencyOption, ip, port, mtu, maxLatency, numChannel, maskChannel, suspendIdle,
+                    syncDelay, sampleRate, mDiscoveryHandle)
         } else {
             Log.e("pulsedroid-rtp", "Engine handle already created")
         }
         return mEngineHandle != 0L
     }
 
+    // Keeps listening for announced streams, so that they are known by the time one is played
+    fun startDiscovery() {
+        if (mDiscoveryHandle == 0L) {
+            mDiscoveryHandle = native_createDiscovery()
+        }
+    }
+
+    fun stopDiscovery() {
+        if (mDiscoveryHandle != 0L) {
+            native_deleteDiscovery(mDiscoveryHandle)
+        }
+        mDiscoveryHandle = 0
+    }
+
     fun initDefaultValues(context: Context) {
         setDefaultStreamValues(context)
     }
@@ -197,6 +274,12 @@ object PulseRtpAudioEngine {
         get() = native_getPktBufferTailMove(mEngineHandle)
     val pktReceived: Long
         get() = native_getPktReceived(mEngineHandle)
+    val syncError: Int
+        get() = native_getSyncError(mEngineHandle)
+    val discoveredStreams: List<DiscoveredStream>
+        get() = native_getDiscoveredStreams(mDiscoveryHandle).mapNotNull {
+            DiscoveredStream.parse(it)
+        }
 
     // Native methods
     @JvmStatic
@@ -207,7 +290,11 @@ object PulseRtpAudioEngine {
         mtu: Int,
         max_latency: Int,
         num_channel: Int,
-        mask_channel: Int
+        mask_channel: Int,
+        suspend_idle: Int,
+        sync_delay: Int,
+        sample_rate: Int,
+        discoveryHandle: Long
     ): Long
 
     @JvmStatic
@@ -243,6 +330,18 @@ object PulseRtpAudioEngine {
     @JvmStatic
     private external fun native_getPktReceived(engineHandle: Long): Long
 
+    @JvmStatic
+    private external fun native_getSyncError(engineHandle: Long): Int
+
+    @JvmStatic
+    private external fun native_createDiscovery(): Long
+
+    @JvmStatic
+    private external fun native_deleteDiscovery(discoveryHandle: Long)
+
+    @JvmStatic
+    private external fun native_getDiscoveredStreams(discoveryHandle: Long): Array<String>
+
     // Load native library
     init {
         System.loadLibrary("pulsedroid-rtp")
@@ -256,6 +355,9 @@ object PulseRtpAudioEngine {
     private const val SHARED_PREF_MAX_LATENCY = "max_latency"
     private const val SHARED_PREF_NUM_CHANNEL = "num_channel"
     private const val SHARED_PREF_MASK_CHANNEL = "mask_channel"
+    private const val SHARED_PREF_SUSPEND_IDLE = "suspend_idle"
+    private const val SHARED_PREF_SYNC_DELAY = "sync_delay"
+    private const val SHARED_PREF_SAMPLE_RATE = "sample_rate"
     private const val SHARED_PREF_URI = "uri"
     private const val SHARED_PREF_PLAY_STATE = "play_state"
 }
\ No newline at end of file
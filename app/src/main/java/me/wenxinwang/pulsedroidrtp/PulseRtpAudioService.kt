@@ -122,6 +122,7 @@ class PulseRtpAudioService : MediaBrowserServiceCompat() {
         initMediaSession()
         initNotificationChannel()
         initWifiLock()
+        PulseRtpAudioEngine.startDiscovery()
 
         // Set an initial PlaybackState with ACTION_PLAY, so media buttons can start the player
         setMediaPlaybackState(PlaybackStateCompat.STATE_STOPPED)
@@ -129,6 +130,7 @@ class PulseRtpAudioService : MediaBrowserServiceCompat() {
 
     override fun onDestroy() {
         stopPlay()
+        PulseRtpAudioEngine.stopDiscovery()
         mMediaSession.isActive = false
         mMediaSession.release()
         if (Build.VERSION.SDK_INT >= Build.VERSION_CODES.O) {